@@ -1,5 +1,14 @@
 #include <stdio.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
 #include "ift.h"
+#include "iftGif.h"
 
 #define GetXCoord(s,p) (((p) % (((s)->xsize)*((s)->ysize))) % (s)->xsize)
 #define GetYCoord(s,p) (((p) % (((s)->xsize)*((s)->ysize))) / (s)->xsize)
@@ -8,6 +17,42 @@
 #define ROUND(x) ((x < 0)?(int)(x-0.5):(int)(x+0.5))
 #define GetVoxelIndex(s,v) ((v.x)+(s)->tby[(v.y)]+(s)->tbz[(v.z)])
 
+/* side of the square output tiles handed to each thread */
+#define MIP_TILE_SIZE 32
+/* bricks of 2^MIP_BRICK_LOG voxels per side summarize the volume for empty-space skipping */
+#define MIP_BRICK_LOG 3
+#define MIP_BRICK_SIZE (1 << MIP_BRICK_LOG)
+/* sweep GIF frame delay, in hundredths of a second */
+#define MIP_GIF_DELAY 4
+/* tolerance on the cosine between view axes for reusing a cached view */
+#define MIP_VIEW_EPSILON 1e-4
+/* a ray this close to a pixel of a cached view, in pixels, is taken as that pixel's ray */
+#define MIP_PIXEL_EPSILON 1e-3
+/* columns whose slab deques one thread keeps at a time in SlidingSlabMIP() */
+#define MIP_SLAB_CHUNK 4096
+/* pyramid levels the render server keeps per volume to answer requests for smaller images */
+#define MIP_SERVE_LEVELS 4
+/* ray spacing of the first pass of a progressive render; each later pass halves it */
+#define MIP_PROGRESSIVE_STEP 4
+/* ray spacing adaptive sampling starts from, refining down to one pixel where needed */
+#define MIP_ADAPTIVE_STEP 8
+/* compile with -DMIP_NEAREST=1 to sample the nearest voxel instead of interpolating */
+#ifndef MIP_NEAREST
+#define MIP_NEAREST 0
+#endif
+/* widest ray packet (AVX-512); MIP_TILE_SIZE must be a multiple of it */
+#define MIP_MAX_PACKET 16
+
+/* per-type kernel bodies are always inlined into a wrapper that switches on the type once */
+#define MIP_ALWAYS_INLINE static inline __attribute__((always_inline))
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define MIP_HAVE_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define MIP_HAVE_X86_SIMD 0
+#endif
+
 int VoxelValue(iftImage *img, iftVoxel v)
 {
     return img->val[GetVoxelIndex(img, v)];
@@ -19,11 +64,114 @@ int sign( int x ){
     return -1;
 }
 
-typedef struct volume
+typedef enum
+{
+    MIP_RAYCAST,
+    MIP_SHEARWARP
+}iftMIPMode;
+
+/* voxel layout read by the ray caster */
+typedef enum
+{
+    MIP_LAYOUT_LINEAR,
+    MIP_LAYOUT_BRICKED
+}iftMIPLayout;
+
+/* how the ray caster walks a ray: DDA samples it once per voxel along the dominant axis;
+   EXACT visits every voxel the ray crosses once (Amanatides-Woo) and takes its value */
+typedef enum
+{
+    MIP_TRAVERSAL_DDA,
+    MIP_TRAVERSAL_EXACT
+}iftMIPTraversal;
+
+/* voxel element type read by the ray caster; AUTO picks the narrowest one that holds the
+   volume range */
+typedef enum
+{
+    MIP_VOXEL_INT32,
+    MIP_VOXEL_UINT16,
+    MIP_VOXEL_INT16,
+    MIP_VOXEL_UINT8,
+    MIP_VOXEL_AUTO
+}iftMIPVoxelType;
+
+/* how the pages of a memory-mapped volume are brought in */
+typedef enum
+{
+    MIP_MAP_LAZY,       /* on first touch */
+    MIP_MAP_POPULATE,   /* all of them by mmap() itself */
+    MIP_MAP_WILLNEED,   /* read ahead in the background */
+    MIP_MAP_RANDOM      /* on first touch, without read-ahead */
+}iftMIPMapHint;
+
+/* ray caster work counters, kept per thread and merged once per frame */
+typedef struct mip_counters
+{
+    long rays;        /* rays cast */
+    long hits;        /* rays that hit the volume */
+    long samples;     /* samples fetched */
+    long skipped;     /* samples not fetched because their brick cannot raise the ray max */
+    long early;       /* rays that stopped at the volume max before their last sample */
+    long pixels;      /* output pixels, one ray each unless sampled adaptively */
+    long walked;      /* local MIP: DDA steps taken by the rays that hit the volume ... */
+    long length;      /* ... out of the steps they span */
+}iftMIPCounters;
+
+/* what a render spent its time and work on, summed over frames; see WriteMIPStats() */
+typedef struct mip_stats
+{
+    iftMIPCounters count;
+    int frames;
+    float load_ms, preprocess_ms, cast_ms, normalize_ms, encode_ms;
+}iftMIPStats;
+
+/* a pinhole camera in voxel coordinates of the full-resolution volume; the view of tilt and
+   spin turns it about the volume centre, so that 0 0 renders it as given */
+typedef struct mip_camera
+{
+    iftVector eye;
+    iftVector at;      /* the point seen at the image centre */
+    iftVector up;      /* towards the top row of the image */
+    float fov;         /* vertical field of view, in degrees */
+    float near, far;   /* distances from the eye between which rays are cast */
+    int xsize, ysize;  /* of the output */
+}iftMIPCamera;
+
+/* rendering knobs shared by the CLI and the library entry points */
+typedef struct mip_options
+{
+    iftMIPMode mode;
+    int nthreads;      /* <= 0 uses all available cores */
+    int skip;          /* ray caster skips bricks that cannot raise the ray max */
+    int level;         /* renders level l of the max pyramid, an image 1/2^l the size */
+    int verbose;       /* prints render progress */
+    int cache;         /* views a sweep keeps for reuse by identical or opposite views */
+    iftMIPLayout layout;
+    iftMIPVoxelType voxels;
+    iftMIPStats *stats;        /* NULL, or where the renderer adds its counters and timings */
+    iftMIPTraversal traversal;
+    int lmip;          /* local MIP: each ray stops at its first local max above threshold */
+    int threshold;
+    const iftMIPCamera *camera;        /* NULL renders orthographic views of the whole volume */
+    float adaptive;    /* > 0 casts rays adaptively, interpolating between rays that differ by at most
+                          this fraction of the volume max; <= 0 casts one ray per pixel */
+}iftMIPOptions;
+
+/* per-frame ray setup: the ray of output pixel (u,v) starts at base + u*du + v*dv and runs
+   along dir, or with a perspective camera starts at eye and runs along base + u*du + v*dv */
+typedef struct ray_setup
 {
-    iftMatrix* orthogonal;
-    iftMatrix* center;
-}iftVolumeFaces;
+    iftVector base;
+    iftVector du;
+    iftVector dv;
+    iftVector dir;
+    int perspective;
+    iftVector eye;
+    float tnear, tfar;         /* the part of each ray that is cast, as distances along it */
+    int xsize, ysize;          /* of the view */
+    int umin, vmin, umax, vmax;        /* pixels outside [umin, umax) x [vmin, vmax) miss the volume */
+}iftRaySetup;
 
 int isValidPoint(iftImage *img, iftVoxel u)
 {
@@ -58,10 +206,18 @@ iftVoxel GetVoxelCoord(iftImage *img, int p)
     return u;
 }
 
-/* this function creas the rotation/translation matrix for the given theta */
+float VolumeDiagonal(iftImage *img)
+{
+    return sqrt((img->xsize * img->xsize) + (img->ysize * img->ysize) + (img->zsize * img->zsize));
+}
+
+/* this function creas the rotation/translation matrix for the given theta. Pixel (u,v) of the
+   diagonal-sized image is placed about its centre ((N - 1) / 2, (N - 1) / 2), so that the
+   views from opposite sides are exact mirror images of each other (u -> N - 1 - u) */
 iftMatrix *createTransformationMatrix(iftImage *img, int xtheta, int ytheta)
 {
     iftMatrix *resMatrix = NULL;
+    int N = VolumeDiagonal(img);
 
     iftVector v1 = {.x = (float)img->xsize / 2.0, .y = (float)img->ysize / 2.0, .z = (float)img->zsize / 2.0};
     iftMatrix *transMatrix1 = iftTranslationMatrix(v1);
@@ -70,7 +226,7 @@ iftMatrix *createTransformationMatrix(iftImage *img, int xtheta, int ytheta)
     iftMatrix *yRotMatrix = iftRotationMatrix(IFT_AXIS_Y, -ytheta);
 
     float D = sqrt(img->xsize*img->xsize + img->ysize*img->ysize);
-    iftVector v2 = {.x = -(D / 2.0), .y = -(D / 2.0), .z = -(D / 2.0)};
+    iftVector v2 = {.x = -((N - 1) / 2.0), .y = -((N - 1) / 2.0), .z = -(D / 2.0)};
     iftMatrix *transMatrix2 = iftTranslationMatrix(v2);
 
 
@@ -79,374 +235,4550 @@ iftMatrix *createTransformationMatrix(iftImage *img, int xtheta, int ytheta)
     return resMatrix;
 }
 
-int DDA(iftImage *img, iftVoxel p1, iftVoxel pn)
+/* where the ray kernels read voxels: iftImage::val as is (x fastest), or a copy stored brick
+   by brick, MIP_BRICK_SIZE^3 voxels each, so that a ray touches about as many cache lines and
+   pages at every viewing angle. In both layouts the index of voxel (x,y,z) is the sum of one
+   term per axis, given by AxisTerm() */
+typedef struct mip_voxels
 {
-    int n, k;
-    //iftVoxel p;
-    iftVoxel p;
-    float J=0, max=0;
-    int Dx,Dy,Dz;
-    float dx=0,dy=0,dz=0;
-    //iftCreateMatrix* J;
+    void *val;
+    iftMIPVoxelType type;
+    int owned;     /* val is a copy rather than iftImage::val */
+    void *map;     /* mapping that val points into, if any */
+    size_t maplen;
+    int size[3];
+    int bricked;
+    int step[3];   /* linear: index stride of each axis; bricked: brick stride of each axis */
+}iftMIPVoxels;
 
+static inline int AxisTerm(const iftMIPVoxels *vox, int c, int axis)
+{
+    if (vox->bricked)
+        return (((c >> MIP_BRICK_LOG) * vox->step[axis]) << (3 * MIP_BRICK_LOG)) +
+               ((c & (MIP_BRICK_SIZE - 1)) << (MIP_BRICK_LOG * axis));
 
-    if (p1.x == pn.x && p1.y == pn.y && p1.z == pn.z)
-        n=1;
-    else{
-        Dx=pn.x - p1.x;
-        Dy=pn.y - p1.y;
-        Dz=pn.z - p1.z;
+    return c * vox->step[axis];
+}
 
-        if( abs(Dx) >= abs(Dy) && abs(Dx) >= abs(Dz) ){
-            n = abs(Dx)+1;
-            dx = sign(Dx);
-            dy = (dx * Dy)/Dx;
-            dz = (dx * Dz)/Dx;
-        }
-        else if ( abs(Dy) >= abs(Dx) && abs(Dy) >= abs(Dz)){
-            n = abs(Dy)+1;
-            dy = sign(Dy);
-            dx = (dy * Dx)/Dy;
-            dz = (dy * Dz)/Dy;
-        }
-        else{
-            n = abs(Dz)+1;
-            dz = sign(Dz);
-            dx = (dz * Dx)/Dz;
-            dy = (dz * Dy)/Dz;
-        }
+MIP_ALWAYS_INLINE int FetchVoxel(const void *val, int idx, iftMIPVoxelType type)
+{
+    switch (type)
+    {
+        case MIP_VOXEL_UINT8:  return ((const uchar *) val)[idx];
+        case MIP_VOXEL_UINT16: return ((const ushort *) val)[idx];
+        case MIP_VOXEL_INT16:  return ((const short *) val)[idx];
+        default:               return ((const int *) val)[idx];
     }
+}
 
-    p.x = p1.x;
-    p.y = p1.y;
-    p.z = p1.z;
-
+static int VoxelTypeSize(iftMIPVoxelType type)
+{
+    switch (type)
+    {
+        case MIP_VOXEL_UINT8:  return sizeof(uchar);
+        case MIP_VOXEL_UINT16: return sizeof(ushort);
+        case MIP_VOXEL_INT16:  return sizeof(short);
+        default:               return sizeof(int);
+    }
+}
 
-    for (k = 1; k < n; k++)
+static int VoxelTypeHolds(iftMIPVoxelType type, int minval, int maxval)
+{
+    switch (type)
     {
-        //printf("debug\n");
-        //J+=  (float)LinearInterpolationValue(img, px, py);
-        //J+=  iftImgVal2D(img, (int)px, (int)py);
-        if (isValidPoint(img,p)){
-          //J= iftImgVal(img,p.x,p.y,p.z);
+        case MIP_VOXEL_UINT8:  return minval >= 0 && maxval <= UCHAR_MAX;
+        case MIP_VOXEL_UINT16: return minval >= 0 && maxval <= USHRT_MAX;
+        case MIP_VOXEL_INT16:  return minval >= SHRT_MIN && maxval <= SHRT_MAX;
+        default:               return 1;
+    }
+}
 
-          iftPoint aux;
-          aux.x = p.x;
-          aux.y = p.y;
-          aux.z = p.z;
+/* narrowest type that holds [minval, maxval] */
+iftMIPVoxelType NarrowestVoxelType(int minval, int maxval)
+{
+    if (VoxelTypeHolds(MIP_VOXEL_UINT8, minval, maxval))
+        return MIP_VOXEL_UINT8;
+    if (VoxelTypeHolds(MIP_VOXEL_UINT16, minval, maxval))
+        return MIP_VOXEL_UINT16;
+    if (VoxelTypeHolds(MIP_VOXEL_INT16, minval, maxval))
+        return MIP_VOXEL_INT16;
+    return MIP_VOXEL_INT32;
+}
+
+/* the ray caster's view of img: img->val itself for linear int32, otherwise a copy in the
+   requested layout and element type */
+iftMIPVoxels *CreateMIPVoxels(iftImage *img, int bricked, iftMIPVoxelType type)
+{
+    int bz, nbz, minval, maxval;
+    size_t nvoxels;
+    iftMIPVoxels *vox = (iftMIPVoxels *) calloc(1, sizeof(iftMIPVoxels));
 
-          // pegando o ponto com interpolacao
-          J= iftImageValueAtPoint(img,aux);
+    vox->size[0] = img->xsize;
+    vox->size[1] = img->ysize;
+    vox->size[2] = img->zsize;
+    vox->bricked = bricked;
 
-          if (J>max)
-            max=J;
+    if (type != MIP_VOXEL_INT32)
+    {
+        minval = iftMinimumValue(img);
+        maxval = iftMaximumValue(img);
+        if (type == MIP_VOXEL_AUTO)
+            type = NarrowestVoxelType(minval, maxval);
+        else if (!VoxelTypeHolds(type, minval, maxval))
+            iftError("Voxel values in [%d, %d] do not fit the requested voxel type", "CreateMIPVoxels",
+                     minval, maxval);
+    }
+    vox->type = type;
+
+    if (!bricked)
+    {
+        vox->step[0] = 1;
+        vox->step[1] = img->xsize;
+        vox->step[2] = img->xsize * img->ysize;
+        nvoxels = (size_t) img->n;
+        nbz = (img->zsize + MIP_BRICK_SIZE - 1) / MIP_BRICK_SIZE;
+        if (type == MIP_VOXEL_INT32)
+        {
+            vox->val = img->val;
+            return vox;
         }
+    }
+    else
+    {
+        int nbx = (img->xsize + MIP_BRICK_SIZE - 1) / MIP_BRICK_SIZE;
+        int nby = (img->ysize + MIP_BRICK_SIZE - 1) / MIP_BRICK_SIZE;
 
-        p.x = p.x + dx;
-        p.y = p.y + dy;
-        p.z = p.z + dz;
+        nbz = (img->zsize + MIP_BRICK_SIZE - 1) / MIP_BRICK_SIZE;
+        vox->step[0] = 1;
+        vox->step[1] = nbx;
+        vox->step[2] = nbx * nby;
+        nvoxels = (size_t) nbx * nby * nbz * MIP_BRICK_SIZE * MIP_BRICK_SIZE * MIP_BRICK_SIZE;
     }
 
-    return (int)max;
-}
+    /* the SIMD kernels gather narrow voxels as 32-bit words, which may read past the last one */
+    vox->val = calloc(nvoxels * VoxelTypeSize(type) + sizeof(int), 1);
+    if (vox->val == NULL)
+        iftError("Cannot allocate the voxel copy", "CreateMIPVoxels");
+    vox->owned = 1;
 
+    #pragma omp parallel for
+    for (bz = 0; bz < nbz; bz++)
+    {
+        int x, y, z, zend = iftMin((bz + 1) * MIP_BRICK_SIZE, img->zsize);
 
+        for (z = bz * MIP_BRICK_SIZE; z < zend; z++)
+            for (y = 0; y < img->ysize; y++)
+            {
+                const int *row = &img->val[img->tby[y] + img->tbz[z]];
+                int yz = AxisTerm(vox, y, 1) + AxisTerm(vox, z, 2);
 
+                for (x = 0; x < img->xsize; x++)
+                {
+                    int i = AxisTerm(vox, x, 0) + yz;
 
-iftVector columnVectorMatrixToVector(iftMatrix *m)
-{
-    iftVector v = {.x = iftMatrixElem(m, 0, 0), .y = iftMatrixElem(m, 0, 1), .z = iftMatrixElem(m, 0, 2)};
-    v.x = iftAlmostZero(v.x) ? 0.0 : v.x;
-    v.y = iftAlmostZero(v.y) ? 0.0 : v.y;
-    v.z = iftAlmostZero(v.z) ? 0.0 : v.z;
+                    switch (type)
+                    {
+                        case MIP_VOXEL_UINT8:  ((uchar *) vox->val)[i] = row[x]; break;
+                        case MIP_VOXEL_UINT16: ((ushort *) vox->val)[i] = row[x]; break;
+                        case MIP_VOXEL_INT16:  ((short *) vox->val)[i] = row[x]; break;
+                        default:               ((int *) vox->val)[i] = row[x]; break;
+                    }
+                }
+            }
+    }
 
-    return v;
+    return vox;
 }
 
-
-int ComputeIntersection(iftMatrix *Tpo, iftImage *img, iftMatrix *Tn, iftVolumeFaces *vf, iftVoxel *p1, iftVoxel *pn)
+void DestroyMIPVoxels(iftMIPVoxels **vox)
 {
+    if (*vox != NULL)
+    {
+        if ((*vox)->owned)
+            free((*vox)->val);
+        if ((*vox)->map != NULL)
+            munmap((*vox)->map, (*vox)->maplen);
+        free(*vox);
+        *vox = NULL;
+    }
+}
 
-    float lambda[6] = { -1};
-    float max=-9999999.9, min=9999999.9;
-    int i;
-    p1->x=pn->x=p1->y=pn->y,p1->z=pn->z=-1;
-    iftMatrix *Nj = iftCreateMatrix(1, 3);
-    iftMatrix *DiffCandP0 = iftCreateMatrix(1, 3);
-    float NdotNj = 0, DiffShiftDotNj = 0;
-    iftVector v1, v2, v3;
-    iftVoxel v;
+static iftMIPVoxelType VoxelTypeFromBits(int bits, const char *filename)
+{
+    switch (bits)
+    {
+        case 8:  return MIP_VOXEL_UINT8;
+        case 16: return MIP_VOXEL_UINT16;
+        case 32: return MIP_VOXEL_INT32;
+        default: iftError("Unsupported %d bits per voxel in %s", "VoxelTypeFromBits", bits, filename);
+    }
+    return MIP_VOXEL_INT32;
+}
 
+/* reads the geometry and voxel type of an uncompressed .scn, .nii or raw file
+   ("<name>_<xsize>_<ysize>_<zsize>_<nbits>_<dx>_<dy>_<dz>.raw", as iftWriteRawSceneWithInfoOnFilename
+   names them) and returns the file offset of its voxels */
+static long ReadVolumeHeader(const char *filename, iftMIPVoxels *vox, float dxyz[3])
+{
+    long offset = 0;
+    int bits;
 
-    for (i = 0; i < 6; i++) {
-      iftMatrixElem(Nj, 0, 0) = vf[i].orthogonal->val[0];
-      iftMatrixElem(Nj, 0, 1) = vf[i].orthogonal->val[1];
-      iftMatrixElem(Nj, 0, 2) = vf[i].orthogonal->val[2];
-      v1 = columnVectorMatrixToVector(Nj);
-      v2 = columnVectorMatrixToVector(Tn);
+    if (iftEndsWith(filename, ".scn"))
+    {
+        char magic[4] = "";
+        FILE *fp = fopen(filename, "rb");
 
-      NdotNj = iftVectorInnerProduct(v1,v2);
+        if (fp == NULL)
+            iftError("Cannot open %s", "ReadVolumeHeader", filename);
+        if (fscanf(fp, "%3s %d %d %d %f %f %f %d", magic, &vox->size[0], &vox->size[1], &vox->size[2],
+                   &dxyz[0], &dxyz[1], &dxyz[2], &bits) != 8 || strcmp(magic, "SCN") != 0)
+            iftError("Invalid SCN header in %s", "ReadVolumeHeader", filename);
+        fgetc(fp);  /* the newline that ends the header */
+        offset = ftell(fp);
+        fclose(fp);
+        vox->type = VoxelTypeFromBits(bits, filename);
+    }
+    else if (iftEndsWith(filename, ".nii"))
+    {
+        unsigned char hdr[348];
+        short dim[8], datatype;
+        float pixdim[8], voxoffset, slope, inter;
+        int sizeofhdr;
+        FILE *fp = fopen(filename, "rb");
 
-      //NdotNj = MatrixInnerProduct(Tn,Nj);
+        if (fp == NULL)
+            iftError("Cannot open %s", "ReadVolumeHeader", filename);
+        if (fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr))
+            iftError("Invalid NIfTI header in %s", "ReadVolumeHeader", filename);
+        fclose(fp);
 
-      if (NdotNj != 0){
+        memcpy(&sizeofhdr, hdr, sizeof(int));
+        memcpy(dim, hdr + 40, sizeof(dim));
+        memcpy(&datatype, hdr + 70, sizeof(short));
+        memcpy(pixdim, hdr + 76, sizeof(pixdim));
+        memcpy(&voxoffset, hdr + 108, sizeof(float));
+        memcpy(&slope, hdr + 112, sizeof(float));
+        memcpy(&inter, hdr + 116, sizeof(float));
 
-        iftMatrixElem(DiffCandP0, 0, 0) = vf[i].center->val[0] - Tpo->val[0];
-        iftMatrixElem(DiffCandP0, 0, 1) = vf[i].center->val[1] - Tpo->val[1];
-        iftMatrixElem(DiffCandP0, 0, 2) = vf[i].center->val[2] - Tpo->val[2];
-        //iftPrintMatrix(DiffCandP0);
+        if (sizeofhdr != 348 || memcmp(hdr + 344, "n+1", 4) != 0)
+            iftError("%s is not a single-file NIfTI-1 in native byte order", "ReadVolumeHeader", filename);
+        if ((slope != 0 && slope != 1) || inter != 0)
+            iftError("Scaled NIfTI voxels in %s cannot be read in place", "ReadVolumeHeader", filename);
 
+        vox->size[0] = dim[1];
+        vox->size[1] = (dim[0] >= 2) ? dim[2] : 1;
+        vox->size[2] = (dim[0] >= 3) ? dim[3] : 1;
+        dxyz[0] = pixdim[1]; dxyz[1] = pixdim[2]; dxyz[2] = pixdim[3];
+        offset = (long) voxoffset;
 
-        v3 = columnVectorMatrixToVector(DiffCandP0);
+        switch (datatype)
+        {
+            case 2:   vox->type = MIP_VOXEL_UINT8; break;
+            case 4:   vox->type = MIP_VOXEL_INT16; break;
+            case 8:   vox->type = MIP_VOXEL_INT32; break;
+            case 512: vox->type = MIP_VOXEL_UINT16; break;
+            default:  iftError("Unsupported NIfTI datatype %d in %s", "ReadVolumeHeader", datatype, filename);
+        }
+    }
+    else if (iftEndsWith(filename, ".raw"))
+    {
+        const char *sfx = filename + strlen(filename);
+        int fields = 0;
 
-        DiffShiftDotNj = iftVectorInnerProduct(v1,v3);
-        //DiffShiftDotNj = MatrixInnerProduct(Nj,DiffCandP0);
+        /* the suffix starts at the 7th underscore from the end */
+        while (sfx > filename && fields < 7)
+            if (*--sfx == '_')
+                fields++;
+        if (fields < 7 || sscanf(sfx, "_%d_%d_%d_%d_%f_%f_%f", &vox->size[0], &vox->size[1], &vox->size[2],
+                                 &bits, &dxyz[0], &dxyz[1], &dxyz[2]) != 7)
+            iftError("Expected raw image suffix of \"_<xsize>_<ysize>_<zsize>_<nbits>_<dx>_<dy>_<dz>\" in %s",
+                     "ReadVolumeHeader", filename);
+        vox->type = VoxelTypeFromBits(bits, filename);
+    }
+    else
+        iftError("Only uncompressed .scn, .nii and .raw files can be read in place: %s", "ReadVolumeHeader", filename);
 
-        //if(NdotNj == 0.000000){
-        //  continue;
-        //}
+    return offset;
+}
 
-        lambda[i]=(float) DiffShiftDotNj / NdotNj;
+/* maps the voxels of filename read-only and reads them in place, in the file order (x fastest)
+   and element type. The file is mapped in front of a zero page, so that the 32-bit gathers of
+   narrow voxels never run off the mapping. Voxels at an offset that is not a multiple of their
+   size are copied instead */
+iftMIPVoxels *MapMIPVoxels(const char *filename, iftMIPMapHint hint, float dxyz[3])
+{
+    iftMIPVoxels *vox = (iftMIPVoxels *) calloc(1, sizeof(iftMIPVoxels));
+    long offset = ReadVolumeHeader(filename, vox, dxyz);
+    size_t nbytes = (size_t) vox->size[0] * vox->size[1] * vox->size[2] * VoxelTypeSize(vox->type);
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    int flags = MAP_PRIVATE | MAP_FIXED;
+    struct stat st;
+    int fd;
 
+    fd = open(filename, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0)
+        iftError("Cannot open %s", "MapMIPVoxels", filename);
+    if ((size_t) st.st_size < offset + nbytes)
+        iftError("%s is shorter than its header says", "MapMIPVoxels", filename);
 
-        v.x = Tpo->val[0] + lambda[i] * Tn->val[0];
-        v.y = Tpo->val[1] + lambda[i] * Tn->val[1];
-        v.z = Tpo->val[2] + lambda[i] * Tn->val[2];
+#ifdef MAP_POPULATE
+    if (hint == MIP_MAP_POPULATE)
+        flags |= MAP_POPULATE;
+#endif
 
-        if (isValidPoint(img, v))
-        {
-          if (lambda[i] < min){
-              p1->x = v.x;
-              p1->y = v.y;
-              p1->z = v.z;
-              min = lambda[i];
-          }
-          if (lambda[i] > max) {
-              pn->x = v.x;
-              pn->y = v.y;
-              pn->z = v.z;
-              max = lambda[i];
-          }
-        }
-      }
-    }
+    vox->maplen = (offset + nbytes + page - 1) / page * page + page;
+    vox->map = mmap(NULL, vox->maplen, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (vox->map == MAP_FAILED || mmap(vox->map, offset + nbytes, PROT_READ, flags, fd, 0) == MAP_FAILED)
+        iftError("Cannot map %s", "MapMIPVoxels", filename);
+    close(fd);
 
-    iftDestroyMatrix(&Nj);
-    iftDestroyMatrix(&DiffCandP0);
+    if (hint == MIP_MAP_WILLNEED)
+        madvise(vox->map, offset + nbytes, MADV_WILLNEED);
+    else if (hint == MIP_MAP_RANDOM)
+        madvise(vox->map, offset + nbytes, MADV_RANDOM);
 
+    vox->step[0] = 1;
+    vox->step[1] = vox->size[0];
+    vox->step[2] = vox->size[0] * vox->size[1];
+    vox->val = (char *) vox->map + offset;
 
-    if ((p1->x != -1) && (pn->x != -1)){
-      return 1;
+    if (offset % VoxelTypeSize(vox->type) != 0)
+    {
+        vox->val = calloc(nbytes + sizeof(int), 1);
+        memcpy(vox->val, (char *) vox->map + offset, nbytes);
+        vox->owned = 1;
+        munmap(vox->map, vox->maplen);
+        vox->map = NULL;
     }
-    else
-      return 0;
+
+    return vox;
 }
 
+/* max intensity of each MIP_BRICK_SIZE^3 brick of the volume, used to skip samples that
+   cannot raise the running max of a ray */
+typedef struct mip_bricks
+{
+    int nbx, nby, nbz;
+    int *max;
+    int volmax;      /* no sample anywhere can beat it, so rays stop once they reach it */
+}iftMIPBricks;
+
+#define GetBrickIndex(b,x,y,z) (((x) >> MIP_BRICK_LOG) + (b)->nbx * (((y) >> MIP_BRICK_LOG) + (b)->nby * ((z) >> MIP_BRICK_LOG)))
+
+/* a sample interpolates the cell above its base voxel, which may reach into the next brick
+   along each axis, so each brick also takes the max of those neighbours */
+void DilateBricks(iftMIPBricks *b)
+{
+    int bx, by, bz, nb = b->nbx * b->nby * b->nbz;
+    int *max = iftAllocIntArray(nb);
+
+    memcpy(max, b->max, sizeof(int) * nb);
+    for (bz = 0; bz < b->nbz; bz++)
+        for (by = 0; by < b->nby; by++)
+            for (bx = 0; bx < b->nbx; bx++)
+            {
+                int i = bx + b->nbx * (by + b->nby * bz);
+                int sx = (bx + 1 < b->nbx) ? 1 : 0;
+                int sy = (by + 1 < b->nby) ? b->nbx : 0;
+                int sz = (bz + 1 < b->nbz) ? b->nbx * b->nby : 0;
 
+                b->max[i] = iftMax(iftMax(iftMax(max[i], max[i + sx]), iftMax(max[i + sy], max[i + sx + sy])),
+                                   iftMax(iftMax(max[i + sz], max[i + sx + sz]),
+                                          iftMax(max[i + sy + sz], max[i + sx + sy + sz])));
+            }
 
-iftVolumeFaces* createVF(iftImage* I)
+    iftFree(max);
+}
+
+iftMIPBricks *CreateMIPBricks(const iftMIPVoxels *vox)
 {
-  int Nx = I->xsize;
-  int Ny = I->ysize;
-  int Nz = I->zsize;
-  int i;
+    int bz;
+    iftMIPBricks *b = (iftMIPBricks *) malloc(sizeof(iftMIPBricks));
+
+    b->nbx = (vox->size[0] + MIP_BRICK_SIZE - 1) / MIP_BRICK_SIZE;
+    b->nby = (vox->size[1] + MIP_BRICK_SIZE - 1) / MIP_BRICK_SIZE;
+    b->nbz = (vox->size[2] + MIP_BRICK_SIZE - 1) / MIP_BRICK_SIZE;
+    b->max = iftAllocIntArray(b->nbx * b->nby * b->nbz);
+    b->volmax = 0;
+
+    /* each thread owns whole brick slabs along z, so no two threads update the same brick */
+    #pragma omp parallel for
+    for (bz = 0; bz < b->nbz; bz++)
+    {
+        int x, y, z, zend = iftMin((bz + 1) * MIP_BRICK_SIZE, vox->size[2]);
+
+        for (z = bz * MIP_BRICK_SIZE; z < zend; z++)
+            for (y = 0; y < vox->size[1]; y++)
+            {
+                int yz = AxisTerm(vox, y, 1) + AxisTerm(vox, z, 2);
+                int *bmax = &b->max[b->nbx * ((y >> MIP_BRICK_LOG) + b->nby * bz)];
 
-  iftVolumeFaces *vf = (iftVolumeFaces *) malloc(sizeof(iftVolumeFaces) * 6);
+                for (x = 0; x < vox->size[0]; x++)
+                {
+                    int v = FetchVoxel(vox->val, AxisTerm(vox, x, 0) + yz, vox->type);
 
-  for (i = 0; i < 6; i++)
-  {
-      vf[i].orthogonal = iftCreateMatrix(1, 4);
-      vf[i].center = iftCreateMatrix(1, 4);
-  }
+                    if (v > bmax[x >> MIP_BRICK_LOG])
+                        bmax[x >> MIP_BRICK_LOG] = v;
+                }
+            }
+    }
 
-  // Face of Plane XY
-  vf[0].orthogonal->val[0] = 0;
-  vf[0].orthogonal->val[1] = 0;
-  vf[0].orthogonal->val[2] = -1;
-  vf[0].orthogonal->val[3] = 1;
+    DilateBricks(b);
+    for (bz = 0; bz < b->nbx * b->nby * b->nbz; bz++)
+        b->volmax = iftMax(b->volmax, b->max[bz]);
 
-  vf[0].center->val[0] = Nx / 2;
-  vf[0].center->val[1] = Ny / 2;
-  vf[0].center->val[2] = 0;
-  vf[0].center->val[3] = 1;
+    return b;
+}
 
-  // Face of Plane XZ
-  vf[1].orthogonal->val[0] = 0;
-  vf[1].orthogonal->val[1] = -1;
-  vf[1].orthogonal->val[2] = 0;
-  vf[1].orthogonal->val[3] = 1;
+void DestroyMIPBricks(iftMIPBricks **b)
+{
+    if (*b != NULL)
+    {
+        iftFree((*b)->max);
+        free(*b);
+        *b = NULL;
+    }
+}
 
-  vf[1].center->val[0] = Nx / 2;
-  vf[1].center->val[1] = 0;
-  vf[1].center->val[2] = Nz / 2;
-  vf[1].center->val[3] = 1;
+/* level 0 is the input volume (not owned); level l+1 keeps the max of each 2x2x2 block of
+   level l, so rendering it gives the MIP of the full volume at 1/2^l resolution */
+typedef struct mip_pyramid
+{
+    int nlevels;
+    iftImage **level;
+}iftMIPPyramid;
 
-  // Face of Plane YZ
-  vf[2].orthogonal->val[0] = -1;
-  vf[2].orthogonal->val[1] = 0;
-  vf[2].orthogonal->val[2] = 0;
-  vf[2].orthogonal->val[3] = 1;
+iftImage *MaxDownsample(iftImage *img)
+{
+    int z;
+    iftImage *half = iftCreateImage((img->xsize + 1) / 2, (img->ysize + 1) / 2, (img->zsize + 1) / 2);
 
-  vf[2].center->val[0] = 0;
-  vf[2].center->val[1] = Ny / 2;
-  vf[2].center->val[2] = Nz / 2;
-  vf[2].center->val[3] = 1;
+    half->dx = img->dx * 2;
+    half->dy = img->dy * 2;
+    half->dz = img->dz * 2;
 
-  // Face of Opposite Plane XY
-  vf[3].orthogonal->val[0] = 0;
-  vf[3].orthogonal->val[1] = 0;
-  vf[3].orthogonal->val[2] = 1;
-  vf[3].orthogonal->val[3] = 1;
+    /* each thread owns a whole output slice, i.e. a pair of input slices */
+    #pragma omp parallel for
+    for (z = 0; z < half->zsize; z++)
+    {
+        int x, y, zz;
+        int *dst = &half->val[half->tbz[z]];
 
-  vf[3].center->val[0] = Nx / 2;
-  vf[3].center->val[1] = Ny / 2;
-  vf[3].center->val[2] = Nz - 1;
-  vf[3].center->val[3] = 1;
+        for (zz = 2 * z; zz < iftMin(2 * z + 2, img->zsize); zz++)
+            for (y = 0; y < img->ysize; y++)
+            {
+                const int *src = &img->val[img->tby[y] + img->tbz[zz]];
+                int *drow = &dst[half->tby[y / 2]];
 
-  // Face of Opposite Plane XZ
-  vf[4].orthogonal->val[0] = 0;
-  vf[4].orthogonal->val[1] = 1;
-  vf[4].orthogonal->val[2] = 0;
-  vf[4].orthogonal->val[3] = 1;
+                for (x = 0; x < img->xsize; x++)
+                {
+                    if (src[x] > drow[x / 2])
+                        drow[x / 2] = src[x];
+                }
+            }
+    }
 
-  vf[4].center->val[0] = Nx / 2;
-  vf[4].center->val[1] = Ny - 1;
-  vf[4].center->val[2] = Nz / 2;
-  vf[4].center->val[3] = 1;
+    return half;
+}
 
-  // Face of Opposite Plane YZ
-  vf[5].orthogonal->val[0] = 1;
-  vf[5].orthogonal->val[1] = 0;
-  vf[5].orthogonal->val[2] = 0;
-  vf[5].orthogonal->val[3] = 1;
+iftMIPPyramid *CreateMIPPyramid(iftImage *img, int nlevels)
+{
+    int l;
+    iftMIPPyramid *pyr = (iftMIPPyramid *) malloc(sizeof(iftMIPPyramid));
 
-  vf[5].center->val[0] = Nx-1;
-  vf[5].center->val[1] = Ny / 2;
-  vf[5].center->val[2] = Nz / 2;
-  vf[5].center->val[3] = 1;
+    pyr->nlevels = nlevels;
+    pyr->level = (iftImage **) calloc(nlevels, sizeof(iftImage *));
+    pyr->level[0] = img;
+    for (l = 1; l < nlevels; l++)
+        pyr->level[l] = MaxDownsample(pyr->level[l - 1]);
 
-  return vf;
+    return pyr;
 }
 
-void DestroyVF(iftVolumeFaces *vf)
+void DestroyMIPPyramid(iftMIPPyramid **pyr)
 {
-    int i;
+    int l;
 
-    for (i = 0; i < 6; i++)
+    if (*pyr != NULL)
     {
-        iftDestroyMatrix(&vf[i].orthogonal);
-        iftDestroyMatrix(&vf[i].center);
+        for (l = 1; l < (*pyr)->nlevels; l++)
+            iftDestroyImage(&(*pyr)->level[l]);
+        free((*pyr)->level);
+        free(*pyr);
+        *pyr = NULL;
     }
-    free(vf);
 }
 
-
-iftMatrix *voxelToMatrix(iftVoxel v)
+/* number of DDA steps from p1 to pn; d receives the per-step increment along the dominant axis */
+int DDASetup(iftVoxel p1, iftVoxel pn, iftVector *d)
 {
-    iftMatrix *voxMat = iftCreateMatrix(1, 4);
-    iftMatrixElem(voxMat, 0, 0) = v.x;
-    iftMatrixElem(voxMat, 0, 1) = v.y;
-    iftMatrixElem(voxMat, 0, 2) = v.z;
-    iftMatrixElem(voxMat, 0, 3) = 1;
+    int n;
+    int Dx,Dy,Dz;
+    float dx=0,dy=0,dz=0;
 
-    return voxMat;
+    if (p1.x == pn.x && p1.y == pn.y && p1.z == pn.z)
+        n=1;
+    else{
+        Dx=pn.x - p1.x;
+        Dy=pn.y - p1.y;
+        Dz=pn.z - p1.z;
+
+        if( abs(Dx) >= abs(Dy) && abs(Dx) >= abs(Dz) ){
+            n = abs(Dx)+1;
+            dx = sign(Dx);
+            dy = (dx * Dy)/Dx;
+            dz = (dx * Dz)/Dx;
+        }
+        else if ( abs(Dy) >= abs(Dx) && abs(Dy) >= abs(Dz)){
+            n = abs(Dy)+1;
+            dy = sign(Dy);
+            dx = (dy * Dx)/Dy;
+            dz = (dy * Dz)/Dy;
+        }
+        else{
+            n = abs(Dz)+1;
+            dz = sign(Dz);
+            dx = (dz * Dx)/Dz;
+            dy = (dz * Dy)/Dz;
+        }
+    }
+
+    d->x = dx;
+    d->y = dy;
+    d->z = dz;
+
+    return n;
 }
 
-iftMatrix *imagePixelToMatrix(iftImage *img, int p)
+/* value at a point inside the volume, given the index of its base voxel (the floor of the
+   point), the fractional offsets from it and the strides to the next voxel along each axis,
+   which are zero on the upper faces. Compiled as trilinear, or as nearest neighbour when
+   MIP_NEAREST is set; either way no rounding happens before the max */
+MIP_ALWAYS_INLINE float SampleCell(const void *val, iftMIPVoxelType type, int idx, int sx, int sy, int sz,
+                                   float fx, float fy, float fz)
 {
-    iftMatrix *pixMat = iftCreateMatrix(1, 4);
-    iftMatrixElem(pixMat, 0, 0) = p % img->xsize;
-    iftMatrixElem(pixMat, 0, 1) = p / img->xsize;
-    iftMatrixElem(pixMat, 0, 2) = 0;
-    iftMatrixElem(pixMat, 0, 3) = 1;
+#define MIP_FETCH(i) ((float) FetchVoxel(val, i, type))
+#if MIP_NEAREST
+    return MIP_FETCH(idx + ((fx >= 0.5) ? sx : 0) + ((fy >= 0.5) ? sy : 0) + ((fz >= 0.5) ? sz : 0));
+#else
+    float v000 = MIP_FETCH(idx),           v100 = MIP_FETCH(idx + sx);
+    float v010 = MIP_FETCH(idx + sy),      v110 = MIP_FETCH(idx + sx + sy);
+    float v001 = MIP_FETCH(idx + sz),      v101 = MIP_FETCH(idx + sx + sz);
+    float v011 = MIP_FETCH(idx + sy + sz), v111 = MIP_FETCH(idx + sx + sy + sz);
+    float c00 = v000 + fx * (v100 - v000), c10 = v010 + fx * (v110 - v010);
+    float c01 = v001 + fx * (v101 - v001), c11 = v011 + fx * (v111 - v011);
+    float c0 = c00 + fy * (c10 - c00), c1 = c01 + fy * (c11 - c01);
 
-    return pixMat;
+    return c0 + fz * (c1 - c0);
+#endif
+#undef MIP_FETCH
 }
 
+/* samples the n points p1 + k*d from p1 to pn. In the linear layout the base voxel index is
+   updated from the change of the integer coordinates, so the tby/tbz tables are never
+   consulted. bricks may be NULL; otherwise samples in bricks that cannot beat the running max
+   are not fetched, and the walk stops once the max reaches the volume max */
+MIP_ALWAYS_INLINE int DDAWalk(const iftMIPVoxels *vox, const iftMIPBricks *bricks, iftVoxel p1, iftVoxel pn,
+                              iftMIPCounters *c, iftMIPVoxelType type)
+{
+    long samples = 0, skipped = 0, early = 0;
+    int n, k, ix, iy, iz, nx, ny, nz, idx, sx, sy, sz;
+    int xs = vox->step[1], xys = vox->step[2];
+    int xlast = vox->size[0] - 1, ylast = vox->size[1] - 1, zlast = vox->size[2] - 1;
+    iftVector d;
+    float x, y, z, t, J, max = 0;
 
+    n = DDASetup(p1, pn, &d);
 
-iftImage *MaximumIntensityProjection(iftImage *img, float xtheta, float ytheta)
-{
-    float diagonal = 0;
-    double maxIntensity;
-    int p=0;
-    int Nu, Nv;
-    iftVoxel p1, pn;
+    ix = p1.x; iy = p1.y; iz = p1.z;
+    idx = ix + iy * xs + iz * xys;
 
-    iftVolumeFaces* volumeFaces;
-    iftMatrix *Mtemp, *T;
-    iftMatrix *Norigin, *Tnorigin;
-    iftMatrix *Tpo;
+    for (k = 0; k < n; k++)
+    {
+        if (bricks != NULL && max >= bricks->volmax)
+        {
+            early = 1;
+            break;
+        }
 
-    diagonal = sqrt((img->xsize * img->xsize) + (img->ysize * img->ysize) + (img->zsize * img->zsize));
-    Nu = Nv = diagonal;
-    iftImage *output = iftCreateImage(Nu, Nv, 1);
-    T  = createTransformationMatrix(img, xtheta, ytheta);
-    //iftPrintMatrix(T);
+        t = (float) k;
+        x = p1.x + t * d.x;
+        y = p1.y + t * d.y;
+        z = p1.z + t * d.z;
+
+        nx = (int) floorf(x); ny = (int) floorf(y); nz = (int) floorf(z);
+        if (!vox->bricked)
+            idx += (nx - ix) + (ny - iy) * xs + (nz - iz) * xys;
+        ix = nx; iy = ny; iz = nz;
+
+        if (x < 0 || y < 0 || z < 0 || x > xlast || y > ylast || z > zlast)
+            continue;
+        if (bricks != NULL && bricks->max[GetBrickIndex(bricks, ix, iy, iz)] <= max)
+        {
+            skipped++;
+            continue;
+        }
 
-    Norigin =  iftCreateMatrix(1, 4);
-    iftMatrixElem(Norigin, 0, 0) = 0;
-    iftMatrixElem(Norigin, 0, 1) = 0;
-    iftMatrixElem(Norigin, 0, 2) = -1;
-    iftMatrixElem(Norigin, 0, 3) = 0;
-    //iftPrintMatrix(Norigin);
+        samples++;
+        if (vox->bricked)
+        {
+            int tx = AxisTerm(vox, ix, 0), ty = AxisTerm(vox, iy, 1), tz = AxisTerm(vox, iz, 2);
 
-    Tnorigin = iftMultMatrices(T, Norigin);
+            idx = tx + ty + tz;
+            sx = (ix < xlast) ? AxisTerm(vox, ix + 1, 0) - tx : 0;
+            sy = (iy < ylast) ? AxisTerm(vox, iy + 1, 1) - ty : 0;
+            sz = (iz < zlast) ? AxisTerm(vox, iz + 1, 2) - tz : 0;
+        }
+        else
+        {
+            sx = (ix < xlast) ? 1 : 0;
+            sy = (iy < ylast) ? xs : 0;
+            sz = (iz < zlast) ? xys : 0;
+        }
 
-    volumeFaces = createVF(img);
+        J = SampleCell(vox->val, type, idx, sx, sy, sz, x - ix, y - iy, z - iz);
+        if (J > max)
+            max = J;
+    }
 
+    if (c != NULL)
+    {
+        c->samples += samples;
+        c->skipped += skipped;
+        c->early += early;
+    }
 
-    for (p = 0; p < output->n; p++)
+    return ROUND(max);
+}
+
+/* c may be NULL */
+int DDA(const iftMIPVoxels *vox, const iftMIPBricks *bricks, iftVoxel p1, iftVoxel pn, iftMIPCounters *c)
+{
+    switch (vox->type)
     {
-        printf("Step : %d\n", p);
-        Mtemp = imagePixelToMatrix(output,p);
-        iftMatrixElem(Mtemp, 0, 2) = diagonal/2;
+        case MIP_VOXEL_UINT8:  return DDAWalk(vox, bricks, p1, pn, c, MIP_VOXEL_UINT8);
+        case MIP_VOXEL_UINT16: return DDAWalk(vox, bricks, p1, pn, c, MIP_VOXEL_UINT16);
+        case MIP_VOXEL_INT16:  return DDAWalk(vox, bricks, p1, pn, c, MIP_VOXEL_INT16);
+        default:               return DDAWalk(vox, bricks, p1, pn, c, MIP_VOXEL_INT32);
+    }
+}
+
+/* local MIP: DDAWalk() that stops at the first sample below the running max once that max is
+   above threshold, i.e. just past the first local max that exceeds it, and returns that max.
+   A ray that never exceeds threshold returns its global max. Bricks are only used below the
+   threshold, where a skipped sample can neither raise the max nor end the ray */
+MIP_ALWAYS_INLINE int LMIPWalk(const iftMIPVoxels *vox, const iftMIPBricks *bricks, iftVoxel p1, iftVoxel pn,
+                               float threshold, iftMIPCounters *c, iftMIPVoxelType type)
+{
+    long samples = 0, skipped = 0, early = 0;
+    int n, k, ix, iy, iz, nx, ny, nz, idx, sx, sy, sz;
+    int xs = vox->step[1], xys = vox->step[2];
+    int xlast = vox->size[0] - 1, ylast = vox->size[1] - 1, zlast = vox->size[2] - 1;
+    iftVector d;
+    float x, y, z, t, J, max = 0;
+
+    n = DDASetup(p1, pn, &d);
 
-        Tpo = iftMultMatrices(T, Mtemp);
+    ix = p1.x; iy = p1.y; iz = p1.z;
+    idx = ix + iy * xs + iz * xys;
 
-        if (ComputeIntersection(Tpo, img, Tnorigin, volumeFaces, &p1, &pn))
+    for (k = 0; k < n; k++)
+    {
+        if (bricks != NULL && max >= bricks->volmax)
         {
-            maxIntensity  = DDA(img,p1,pn);
+            early = 1;
+            break;
+        }
+
+        t = (float) k;
+        x = p1.x + t * d.x;
+        y = p1.y + t * d.y;
+        z = p1.z + t * d.z;
+
+        nx = (int) floorf(x); ny = (int) floorf(y); nz = (int) floorf(z);
+        if (!vox->bricked)
+            idx += (nx - ix) + (ny - iy) * xs + (nz - iz) * xys;
+        ix = nx; iy = ny; iz = nz;
 
-            output->val[p] = maxIntensity;
+        if (x < 0 || y < 0 || z < 0 || x > xlast || y > ylast || z > zlast)
+            continue;
+        if (bricks != NULL && max <= threshold && bricks->max[GetBrickIndex(bricks, ix, iy, iz)] <= max)
+        {
+            skipped++;
+            continue;
         }
 
+        samples++;
+        if (vox->bricked)
+        {
+            int tx = AxisTerm(vox, ix, 0), ty = AxisTerm(vox, iy, 1), tz = AxisTerm(vox, iz, 2);
+
+            idx = tx + ty + tz;
+            sx = (ix < xlast) ? AxisTerm(vox, ix + 1, 0) - tx : 0;
+            sy = (iy < ylast) ? AxisTerm(vox, iy + 1, 1) - ty : 0;
+            sz = (iz < zlast) ? AxisTerm(vox, iz + 1, 2) - tz : 0;
+        }
+        else
+        {
+            sx = (ix < xlast) ? 1 : 0;
+            sy = (iy < ylast) ? xs : 0;
+            sz = (iz < zlast) ? xys : 0;
+        }
 
-        iftDestroyMatrix(&Mtemp);
-        iftDestroyMatrix(&Tpo);
+        J = SampleCell(vox->val, type, idx, sx, sy, sz, x - ix, y - iy, z - iz);
+        if (J > max)
+            max = J;
+        else if (J < max && max > threshold)
+            break;
     }
 
-    iftDestroyMatrix(&T);
-    iftDestroyMatrix(&Norigin);
-    iftDestroyMatrix(&Tnorigin);
-    DestroyVF(volumeFaces);
+    if (c != NULL)
+    {
+        c->samples += samples;
+        c->skipped += skipped;
+        c->early += early;
+        c->walked += iftMin(k + 1, n);
+        c->length += n;
+    }
 
-    return output;
+    return ROUND(max);
 }
 
+/* c may be NULL */
+int LMIPDDA(const iftMIPVoxels *vox, const iftMIPBricks *bricks, iftVoxel p1, iftVoxel pn, int threshold,
+            iftMIPCounters *c)
+{
+    switch (vox->type)
+    {
+        case MIP_VOXEL_UINT8:  return LMIPWalk(vox, bricks, p1, pn, threshold, c, MIP_VOXEL_UINT8);
+        case MIP_VOXEL_UINT16: return LMIPWalk(vox, bricks, p1, pn, threshold, c, MIP_VOXEL_UINT16);
+        case MIP_VOXEL_INT16:  return LMIPWalk(vox, bricks, p1, pn, threshold, c, MIP_VOXEL_INT16);
+        default:               return LMIPWalk(vox, bricks, p1, pn, threshold, c, MIP_VOXEL_INT32);
+    }
+}
 
-int main(int argc, char *argv[])
+/* visits, from the entry point o to o + span*d, every voxel the ray crosses, each once: the
+   walk steps into the neighbour across whichever voxel face the ray reaches first (tmax), the
+   faces along an axis being tdelta apart. Voxel i covers [i - 0.5, i + 0.5) along each axis.
+   The max is the exact nearest-neighbour MIP of the ray; bricks as in DDAWalk() */
+MIP_ALWAYS_INLINE int ExactWalk(const iftMIPVoxels *vox, const iftMIPBricks *bricks, iftVector o, iftVector d,
+                                float span, iftMIPCounters *c, iftMIPVoxelType type)
 {
-    //if (argc != 6)
-    //    Error("Run: ./main <filename> <output> <xtheta> <ytheta> , "main");
+    long samples = 0, skipped = 0, early = 0;
+    float oc[3] = {o.x, o.y, o.z}, dc[3] = {d.x, d.y, d.z};
+    float tmax[3], tdelta[3];
+    int p[3], step[3], term[3], a, max = 0;
 
-    char buffer[512];
+    for (a = 0; a < 3; a++)
+    {
+        p[a] = iftMax(0, iftMin(vox->size[a] - 1, (int) floorf(oc[a] + 0.5f)));
+        step[a] = (dc[a] > 0) ? 1 : (dc[a] < 0) ? -1 : 0;
+        tdelta[a] = (step[a] != 0) ? step[a] / dc[a] : FLT_MAX;
+        tmax[a] = (step[a] != 0) ? (p[a] + 0.5f * step[a] - oc[a]) / dc[a] : FLT_MAX;
+        term[a] = AxisTerm(vox, p[a], a);
+    }
 
-    float tx, ty;
-    tx = atof(argv[3]);
-    ty = atof(argv[4]);
-    //tz = atof(argv[5]);
-    char *imgFileName = iftCopyString(argv[1]);
-    iftImage *img = iftReadImageByExt(imgFileName);
+    for (;;)
+    {
+        if (bricks != NULL && max >= bricks->volmax)
+        {
+            early = 1;
+            break;
+        }
 
-    iftImage *output = NULL;
+        if (bricks != NULL && bricks->max[GetBrickIndex(bricks, p[0], p[1], p[2])] <= max)
+            skipped++;
+        else
+        {
+            int J = FetchVoxel(vox->val, term[0] + term[1] + term[2], type);
 
-    output = MaximumIntensityProjection(img, tx, ty);
-    sprintf(buffer, "data/%.1f%.1f%s", tx, ty, argv[2]);
-    iftImage *normalizedImage= iftNormalize(output,0,255);
+            samples++;
+            if (J > max)
+                max = J;
+        }
+
+        a = (tmax[0] <= tmax[1]) ? ((tmax[0] <= tmax[2]) ? 0 : 2) : ((tmax[1] <= tmax[2]) ? 1 : 2);
+        if (tmax[a] > span)
+            break;
+        p[a] += step[a];
+        if (p[a] < 0 || p[a] >= vox->size[a])
+            break;
+        term[a] = AxisTerm(vox, p[a], a);
+        tmax[a] += tdelta[a];
+    }
+
+    if (c != NULL)
+    {
+        c->samples += samples;
+        c->skipped += skipped;
+        c->early += early;
+    }
+
+    return max;
+}
+
+/* c may be NULL */
+int ExactDDA(const iftMIPVoxels *vox, const iftMIPBricks *bricks, iftVector o, iftVector d, float span,
+             iftMIPCounters *c)
+{
+    switch (vox->type)
+    {
+        case MIP_VOXEL_UINT8:  return ExactWalk(vox, bricks, o, d, span, c, MIP_VOXEL_UINT8);
+        case MIP_VOXEL_UINT16: return ExactWalk(vox, bricks, o, d, span, c, MIP_VOXEL_UINT16);
+        case MIP_VOXEL_INT16:  return ExactWalk(vox, bricks, o, d, span, c, MIP_VOXEL_INT16);
+        default:               return ExactWalk(vox, bricks, o, d, span, c, MIP_VOXEL_INT32);
+    }
+}
+
+/* projections that one traversal of a view can produce together; see ProjectMIPView() */
+typedef enum
+{
+    MIP_PROJECT_MAX   = 1,     /* MIP */
+    MIP_PROJECT_MIN   = 2,     /* MinIP */
+    MIP_PROJECT_MEAN  = 4,     /* average intensity projection */
+    MIP_PROJECT_DEPTH = 8      /* distance from the image plane to the max */
+}iftMIPProjection;
+
+#define MIP_PROJECT_ALL 15
+
+/* running state of the reducers along one ray */
+typedef struct mip_reduce
+{
+    float max, min, sum, depth;
+    int count;
+}iftMIPReduce;
+
+/* folds the sample J, taken at depth, into the reducers that outputs asks for; outputs is a
+   constant wherever this is inlined, so the reducers that are not asked for compile away */
+MIP_ALWAYS_INLINE void ReduceSample(iftMIPReduce *r, float J, float depth, int outputs)
+{
+    if ((outputs & (MIP_PROJECT_MAX | MIP_PROJECT_DEPTH)) && J > r->max)
+    {
+        r->max = J;
+        if (outputs & MIP_PROJECT_DEPTH)
+            r->depth = depth;
+    }
+    if ((outputs & MIP_PROJECT_MIN) && J < r->min)
+        r->min = J;
+    if (outputs & MIP_PROJECT_MEAN)
+    {
+        r->sum += J;
+        r->count++;
+    }
+}
+
+/* DDAWalk() with the reducers of outputs in place of the max; the max comes out the same.
+   depth0 is the depth of p1 and dir the unit ray direction. Bricks only bound the max, so they
+   are used when nothing but the max and its depth is asked for */
+MIP_ALWAYS_INLINE void ProjectWalk(const iftMIPVoxels *vox, const iftMIPBricks *bricks, iftVoxel p1, iftVoxel pn,
+                                   float depth0, iftVector dir, int outputs, iftMIPCounters *c, iftMIPVoxelType type,
+                                   iftMIPReduce *r)
+{
+    long samples = 0, skipped = 0, early = 0;
+    int n, k, ix, iy, iz, nx, ny, nz, idx, sx, sy, sz;
+    int xs = vox->step[1], xys = vox->step[2];
+    int xlast = vox->size[0] - 1, ylast = vox->size[1] - 1, zlast = vox->size[2] - 1;
+    int prune = (bricks != NULL && !(outputs & (MIP_PROJECT_MIN | MIP_PROJECT_MEAN)));
+    iftVector d;
+    float x, y, z, t, ddepth;
+
+    n = DDASetup(p1, pn, &d);
+    ddepth = d.x * dir.x + d.y * dir.y + d.z * dir.z;
+
+    ix = p1.x; iy = p1.y; iz = p1.z;
+    idx = ix + iy * xs + iz * xys;
+
+    for (k = 0; k < n; k++)
+    {
+        if (prune && r->max >= bricks->volmax)
+        {
+            early = 1;
+            break;
+        }
+
+        t = (float) k;
+        x = p1.x + t * d.x;
+        y = p1.y + t * d.y;
+        z = p1.z + t * d.z;
+
+        nx = (int) floorf(x); ny = (int) floorf(y); nz = (int) floorf(z);
+        if (!vox->bricked)
+            idx += (nx - ix) + (ny - iy) * xs + (nz - iz) * xys;
+        ix = nx; iy = ny; iz = nz;
+
+        if (x < 0 || y < 0 || z < 0 || x > xlast || y > ylast || z > zlast)
+            continue;
+        if (prune && bricks->max[GetBrickIndex(bricks, ix, iy, iz)] <= r->max)
+        {
+            skipped++;
+            continue;
+        }
+
+        samples++;
+        if (vox->bricked)
+        {
+            int tx = AxisTerm(vox, ix, 0), ty = AxisTerm(vox, iy, 1), tz = AxisTerm(vox, iz, 2);
+
+            idx = tx + ty + tz;
+            sx = (ix < xlast) ? AxisTerm(vox, ix + 1, 0) - tx : 0;
+            sy = (iy < ylast) ? AxisTerm(vox, iy + 1, 1) - ty : 0;
+            sz = (iz < zlast) ? AxisTerm(vox, iz + 1, 2) - tz : 0;
+        }
+        else
+        {
+            sx = (ix < xlast) ? 1 : 0;
+            sy = (iy < ylast) ? xs : 0;
+            sz = (iz < zlast) ? xys : 0;
+        }
+
+        ReduceSample(r, SampleCell(vox->val, type, idx, sx, sy, sz, x - ix, y - iy, z - iz),
+                     depth0 + t * ddepth, outputs);
+    }
+
+    if (c != NULL)
+    {
+        c->samples += samples;
+        c->skipped += skipped;
+        c->early += early;
+    }
+}
+
+/* ProjectWalk() specialized on outputs for one voxel type */
+MIP_ALWAYS_INLINE void ProjectWalkOutputs(const iftMIPVoxels *vox, const iftMIPBricks *bricks, iftVoxel p1,
+                                          iftVoxel pn, float depth0, iftVector dir, int outputs, iftMIPCounters *c,
+                                          iftMIPVoxelType type, iftMIPReduce *r)
+{
+#define MIP_OUTPUTS_CASE(o) case o: ProjectWalk(vox, bricks, p1, pn, depth0, dir, o, c, type, r); break
+    switch (outputs)
+    {
+        MIP_OUTPUTS_CASE(1);  MIP_OUTPUTS_CASE(2);  MIP_OUTPUTS_CASE(3);  MIP_OUTPUTS_CASE(4);
+        MIP_OUTPUTS_CASE(5);  MIP_OUTPUTS_CASE(6);  MIP_OUTPUTS_CASE(7);  MIP_OUTPUTS_CASE(8);
+        MIP_OUTPUTS_CASE(9);  MIP_OUTPUTS_CASE(10); MIP_OUTPUTS_CASE(11); MIP_OUTPUTS_CASE(12);
+        MIP_OUTPUTS_CASE(13); MIP_OUTPUTS_CASE(14); MIP_OUTPUTS_CASE(15);
+        default: break;
+    }
+#undef MIP_OUTPUTS_CASE
+}
+
+/* runs the reducers of outputs (a set of iftMIPProjection) along the ray p1 -> pn; c may be NULL */
+void ProjectRay(const iftMIPVoxels *vox, const iftMIPBricks *bricks, iftVoxel p1, iftVoxel pn, float depth0,
+                iftVector dir, int outputs, iftMIPCounters *c, iftMIPReduce *r)
+{
+    switch (vox->type)
+    {
+        case MIP_VOXEL_UINT8:
+            ProjectWalkOutputs(vox, bricks, p1, pn, depth0, dir, outputs, c, MIP_VOXEL_UINT8, r);
+            break;
+        case MIP_VOXEL_UINT16:
+            ProjectWalkOutputs(vox, bricks, p1, pn, depth0, dir, outputs, c, MIP_VOXEL_UINT16, r);
+            break;
+        case MIP_VOXEL_INT16:
+            ProjectWalkOutputs(vox, bricks, p1, pn, depth0, dir, outputs, c, MIP_VOXEL_INT16, r);
+            break;
+        default:
+            ProjectWalkOutputs(vox, bricks, p1, pn, depth0, dir, outputs, c, MIP_VOXEL_INT32, r);
+            break;
+    }
+}
+
+
+/* per-thread ray state for one packet, padded so that threads do not share cache lines */
+typedef struct mip_scratch
+{
+    iftVoxel p1[MIP_MAX_PACKET], pn[MIP_MAX_PACKET];
+    int hit[MIP_MAX_PACKET];
+    int max[MIP_MAX_PACKET];
+    int pix[MIP_MAX_PACKET];   /* output pixel of each ray, for packets of scattered pixels */
+    iftVector enter[MIP_MAX_PACKET];   /* where each ray enters the volume, for exact traversal */
+    float span[MIP_MAX_PACKET];        /* length of each ray inside the volume */
+    float near[MIP_MAX_PACKET];        /* distance from the ray origin to the entry point */
+    iftVector dir[MIP_MAX_PACKET];
+    int threshold;                     /* of the local MIP kernel */
+    iftMIPCounters count;
+    char pad[64];
+}iftMIPScratch;
+
+/* traverses the first width rays held in the scratch, writing each ray max to s->max and
+   adding to s->count */
+typedef void (*iftDDAPacketFunc)(const iftMIPVoxels *vox, const iftMIPBricks *bricks, iftMIPScratch *s);
+
+typedef struct mip_kernel
+{
+    const char *name;
+    int width;
+    iftDDAPacketFunc packet;
+}iftMIPKernel;
+
+void DDAPacketScalar(const iftMIPVoxels *vox, const iftMIPBricks *bricks, iftMIPScratch *s)
+{
+    s->max[0] = s->hit[0] ? DDA(vox, bricks, s->p1[0], s->pn[0], &s->count) : 0;
+}
+
+/* packet width of the kernels without SIMD code (exact traversal, local MIP); their packets
+   only share the ray clipping */
+#define MIP_SCALAR_WIDTH 8
+
+void ExactPacket(const iftMIPVoxels *vox, const iftMIPBricks *bricks, iftMIPScratch *s)
+{
+    int i;
+
+    for (i = 0; i < MIP_SCALAR_WIDTH; i++)
+        s->max[i] = s->hit[i] ? ExactDDA(vox, bricks, s->enter[i], s->dir[i], s->span[i], &s->count) : 0;
+}
+
+void LMIPPacket(const iftMIPVoxels *vox, const iftMIPBricks *bricks, iftMIPScratch *s)
+{
+    int i;
+
+    for (i = 0; i < MIP_SCALAR_WIDTH; i++)
+        s->max[i] = s->hit[i] ? LMIPDDA(vox, bricks, s->p1[i], s->pn[i], s->threshold, &s->count) : 0;
+}
+
+#if MIP_HAVE_X86_SIMD
+/* loads the DDA setup of each lane; rays that missed the volume get zero steps */
+static void LoadPacketSetup(iftMIPScratch *s, int width, int *x, int *y, int *z,
+                            float *dx, float *dy, float *dz, int *n, int *nmax)
+{
+    int i;
+    iftVector d;
+
+    *nmax = 0;
+    for (i = 0; i < width; i++)
+    {
+        n[i] = s->hit[i] ? DDASetup(s->p1[i], s->pn[i], &d) : 0;
+        if (!s->hit[i])
+            d.x = d.y = d.z = 0;
+        x[i] = s->p1[i].x; y[i] = s->p1[i].y; z[i] = s->p1[i].z;
+        dx[i] = d.x; dy[i] = d.y; dz[i] = d.z;
+        if (n[i] > *nmax)
+            *nmax = n[i];
+    }
+}
+
+/* 8 rays in lockstep, sampled at the same points and with the same arithmetic as DDA() */
+__attribute__((target("avx2")))
+static inline __m256i AxisTermAVX2(const iftMIPVoxels *vox, __m256i c, int axis)
+{
+    __m256i step = _mm256_set1_epi32(vox->step[axis]);
+
+    if (vox->bricked)
+        return _mm256_add_epi32(
+            _mm256_slli_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(c, MIP_BRICK_LOG), step), 3 * MIP_BRICK_LOG),
+            _mm256_slli_epi32(_mm256_and_si256(c, _mm256_set1_epi32(MIP_BRICK_SIZE - 1)), MIP_BRICK_LOG * axis));
+
+    return _mm256_mullo_epi32(c, step);
+}
+
+/* 32-bit gathers of voxels of any type; narrow ones are widened from the low bytes of the word */
+__attribute__((target("avx2")))
+MIP_ALWAYS_INLINE __m256i GatherAVX2(const void *val, __m256i idx, __m256i valid, iftMIPVoxelType type)
+{
+    __m256i zero = _mm256_setzero_si256(), w;
+
+    switch (type)
+    {
+        case MIP_VOXEL_UINT8:
+            w = _mm256_mask_i32gather_epi32(zero, (const int *) val, idx, valid, 1);
+            return _mm256_and_si256(w, _mm256_set1_epi32(0xFF));
+        case MIP_VOXEL_UINT16:
+            w = _mm256_mask_i32gather_epi32(zero, (const int *) val, idx, valid, 2);
+            return _mm256_and_si256(w, _mm256_set1_epi32(0xFFFF));
+        case MIP_VOXEL_INT16:
+            w = _mm256_mask_i32gather_epi32(zero, (const int *) val, idx, valid, 2);
+            return _mm256_srai_epi32(_mm256_slli_epi32(w, 16), 16);
+        default:
+            return _mm256_mask_i32gather_epi32(zero, (const int *) val, idx, valid, 4);
+    }
+}
+
+__attribute__((target("avx2")))
+MIP_ALWAYS_INLINE void DDAPacketAVX2Walk(const iftMIPVoxels *vox, const iftMIPBricks *bricks, iftMIPScratch *s,
+                                         iftMIPVoxelType type)
+{
+    int x[8], y[8], z[8], n[8], nmax, k;
+    long samples = 0, skipped = 0;
+    float dx[8], dy[8], dz[8];
+
+    LoadPacketSetup(s, 8, x, y, z, dx, dy, dz, n, &nmax);
+
+    __m256 px1 = _mm256_cvtepi32_ps(_mm256_loadu_si256((__m256i *) x));
+    __m256 py1 = _mm256_cvtepi32_ps(_mm256_loadu_si256((__m256i *) y));
+    __m256 pz1 = _mm256_cvtepi32_ps(_mm256_loadu_si256((__m256i *) z));
+    __m256i vn = _mm256_loadu_si256((__m256i *) n);
+    __m256 vdx = _mm256_loadu_ps(dx);
+    __m256 vdy = _mm256_loadu_ps(dy);
+    __m256 vdz = _mm256_loadu_ps(dz);
+    __m256i xlast = _mm256_set1_epi32(vox->size[0] - 1);
+    __m256i ylast = _mm256_set1_epi32(vox->size[1] - 1);
+    __m256i zlast = _mm256_set1_epi32(vox->size[2] - 1);
+    __m256 fxlast = _mm256_set1_ps(vox->size[0] - 1);
+    __m256 fylast = _mm256_set1_ps(vox->size[1] - 1);
+    __m256 fzlast = _mm256_set1_ps(vox->size[2] - 1);
+    __m256 fzero = _mm256_setzero_ps();
+    __m256i one = _mm256_set1_epi32(1);
+    __m256i zero = _mm256_setzero_si256();
+    __m256 vmax = fzero;
+    __m256 volmax = _mm256_set1_ps(bricks ? bricks->volmax : FLT_MAX);
+    __m256i nbx = _mm256_set1_epi32(bricks ? bricks->nbx : 0);
+    __m256i nbxy = _mm256_set1_epi32(bricks ? bricks->nbx * bricks->nby : 0);
+    __m256i early = zero;
+
+    for (k = 0; k < nmax; k++)
+    {
+        __m256 t = _mm256_set1_ps((float) k);
+        __m256 px = _mm256_add_ps(px1, _mm256_mul_ps(t, vdx));
+        __m256 py = _mm256_add_ps(py1, _mm256_mul_ps(t, vdy));
+        __m256 pz = _mm256_add_ps(pz1, _mm256_mul_ps(t, vdz));
+
+        __m256i inray = _mm256_cmpgt_epi32(vn, _mm256_set1_epi32(k));
+        __m256i active = _mm256_and_si256(inray, _mm256_castps_si256(_mm256_cmp_ps(volmax, vmax, _CMP_GT_OQ)));
+        early = _mm256_or_si256(early, _mm256_andnot_si256(active, inray));
+        if (_mm256_testz_si256(active, active))
+            break;
+
+        __m256 inside = _mm256_and_ps(_mm256_cmp_ps(px, fzero, _CMP_GE_OQ), _mm256_cmp_ps(px, fxlast, _CMP_LE_OQ));
+        inside = _mm256_and_ps(inside, _mm256_and_ps(_mm256_cmp_ps(py, fzero, _CMP_GE_OQ), _mm256_cmp_ps(py, fylast, _CMP_LE_OQ)));
+        inside = _mm256_and_ps(inside, _mm256_and_ps(_mm256_cmp_ps(pz, fzero, _CMP_GE_OQ), _mm256_cmp_ps(pz, fzlast, _CMP_LE_OQ)));
+        __m256i valid = _mm256_and_si256(active, _mm256_castps_si256(inside));
+
+        /* inside points are non-negative, so truncation is the floor */
+        __m256i ix = _mm256_cvttps_epi32(px), iy = _mm256_cvttps_epi32(py), iz = _mm256_cvttps_epi32(pz);
+
+        if (bricks != NULL)
+        {
+            __m256i bidx = _mm256_add_epi32(_mm256_srli_epi32(ix, MIP_BRICK_LOG),
+                           _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(iy, MIP_BRICK_LOG), nbx),
+                                            _mm256_mullo_epi32(_mm256_srli_epi32(iz, MIP_BRICK_LOG), nbxy)));
+            __m256 bmax = _mm256_cvtepi32_ps(_mm256_mask_i32gather_epi32(zero, bricks->max, bidx, valid, 4));
+
+            skipped += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(valid)));
+            valid = _mm256_and_si256(valid, _mm256_castps_si256(_mm256_cmp_ps(bmax, vmax, _CMP_GT_OQ)));
+            skipped -= __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(valid)));
+        }
+        if (_mm256_testz_si256(valid, valid))
+            continue;
+        samples += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(valid)));
+
+        __m256i tx = AxisTermAVX2(vox, ix, 0), ty = AxisTermAVX2(vox, iy, 1), tz = AxisTermAVX2(vox, iz, 2);
+        __m256i idx = _mm256_add_epi32(tx, _mm256_add_epi32(ty, tz));
+        __m256i sx = _mm256_and_si256(_mm256_cmpgt_epi32(xlast, ix),
+                                      _mm256_sub_epi32(AxisTermAVX2(vox, _mm256_add_epi32(ix, one), 0), tx));
+        __m256i sy = _mm256_and_si256(_mm256_cmpgt_epi32(ylast, iy),
+                                      _mm256_sub_epi32(AxisTermAVX2(vox, _mm256_add_epi32(iy, one), 1), ty));
+        __m256i sz = _mm256_and_si256(_mm256_cmpgt_epi32(zlast, iz),
+                                      _mm256_sub_epi32(AxisTermAVX2(vox, _mm256_add_epi32(iz, one), 2), tz));
+        __m256 fx = _mm256_sub_ps(px, _mm256_cvtepi32_ps(ix));
+        __m256 fy = _mm256_sub_ps(py, _mm256_cvtepi32_ps(iy));
+        __m256 fz = _mm256_sub_ps(pz, _mm256_cvtepi32_ps(iz));
+        __m256 J;
+
+#if MIP_NEAREST
+        __m256 half = _mm256_set1_ps(0.5);
+        idx = _mm256_add_epi32(idx, _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(fx, half, _CMP_GE_OQ)), sx));
+        idx = _mm256_add_epi32(idx, _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(fy, half, _CMP_GE_OQ)), sy));
+        idx = _mm256_add_epi32(idx, _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(fz, half, _CMP_GE_OQ)), sz));
+        J = _mm256_cvtepi32_ps(GatherAVX2(vox->val, idx, valid, type));
+#else
+#define MIP_GATHER8(off) _mm256_cvtepi32_ps(GatherAVX2(vox->val, _mm256_add_epi32(idx, off), valid, type))
+        __m256i sxy = _mm256_add_epi32(sx, sy);
+        __m256 v000 = MIP_GATHER8(zero), v100 = MIP_GATHER8(sx);
+        __m256 v010 = MIP_GATHER8(sy), v110 = MIP_GATHER8(sxy);
+        __m256 v001 = MIP_GATHER8(sz), v101 = MIP_GATHER8(_mm256_add_epi32(sx, sz));
+        __m256 v011 = MIP_GATHER8(_mm256_add_epi32(sy, sz)), v111 = MIP_GATHER8(_mm256_add_epi32(sxy, sz));
+#undef MIP_GATHER8
+        __m256 c00 = _mm256_add_ps(v000, _mm256_mul_ps(fx, _mm256_sub_ps(v100, v000)));
+        __m256 c10 = _mm256_add_ps(v010, _mm256_mul_ps(fx, _mm256_sub_ps(v110, v010)));
+        __m256 c01 = _mm256_add_ps(v001, _mm256_mul_ps(fx, _mm256_sub_ps(v101, v001)));
+        __m256 c11 = _mm256_add_ps(v011, _mm256_mul_ps(fx, _mm256_sub_ps(v111, v011)));
+        __m256 c0 = _mm256_add_ps(c00, _mm256_mul_ps(fy, _mm256_sub_ps(c10, c00)));
+        __m256 c1 = _mm256_add_ps(c01, _mm256_mul_ps(fy, _mm256_sub_ps(c11, c01)));
+        J = _mm256_add_ps(c0, _mm256_mul_ps(fz, _mm256_sub_ps(c1, c0)));
+#endif
+        vmax = _mm256_blendv_ps(vmax, _mm256_max_ps(vmax, J), _mm256_castsi256_ps(valid));
+    }
+
+    /* the maxima are non-negative, so adding 0.5 and truncating is ROUND() */
+    _mm256_storeu_si256((__m256i *) s->max, _mm256_cvttps_epi32(_mm256_add_ps(vmax, _mm256_set1_ps(0.5))));
+    s->count.samples += samples;
+    s->count.skipped += skipped;
+    s->count.early += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(early)));
+}
+
+__attribute__((target("avx2")))
+void DDAPacketAVX2(const iftMIPVoxels *vox, const iftMIPBricks *bricks, iftMIPScratch *s)
+{
+    switch (vox->type)
+    {
+        case MIP_VOXEL_UINT8:  DDAPacketAVX2Walk(vox, bricks, s, MIP_VOXEL_UINT8); break;
+        case MIP_VOXEL_UINT16: DDAPacketAVX2Walk(vox, bricks, s, MIP_VOXEL_UINT16); break;
+        case MIP_VOXEL_INT16:  DDAPacketAVX2Walk(vox, bricks, s, MIP_VOXEL_INT16); break;
+        default:               DDAPacketAVX2Walk(vox, bricks, s, MIP_VOXEL_INT32); break;
+    }
+}
+
+/* 16 rays in lockstep, same sampling as DDAPacketAVX2() */
+__attribute__((target("avx512f")))
+static inline __m512i AxisTermAVX512(const iftMIPVoxels *vox, __m512i c, int axis)
+{
+    __m512i step = _mm512_set1_epi32(vox->step[axis]);
+
+    if (vox->bricked)
+        return _mm512_add_epi32(
+            _mm512_slli_epi32(_mm512_mullo_epi32(_mm512_srli_epi32(c, MIP_BRICK_LOG), step), 3 * MIP_BRICK_LOG),
+            _mm512_slli_epi32(_mm512_and_si512(c, _mm512_set1_epi32(MIP_BRICK_SIZE - 1)), MIP_BRICK_LOG * axis));
+
+    return _mm512_mullo_epi32(c, step);
+}
+
+__attribute__((target("avx512f")))
+MIP_ALWAYS_INLINE __m512i GatherAVX512(const void *val, __m512i idx, __mmask16 valid, iftMIPVoxelType type)
+{
+    __m512i zero = _mm512_setzero_si512(), w;
+
+    switch (type)
+    {
+        case MIP_VOXEL_UINT8:
+            w = _mm512_mask_i32gather_epi32(zero, valid, idx, val, 1);
+            return _mm512_and_si512(w, _mm512_set1_epi32(0xFF));
+        case MIP_VOXEL_UINT16:
+            w = _mm512_mask_i32gather_epi32(zero, valid, idx, val, 2);
+            return _mm512_and_si512(w, _mm512_set1_epi32(0xFFFF));
+        case MIP_VOXEL_INT16:
+            w = _mm512_mask_i32gather_epi32(zero, valid, idx, val, 2);
+            return _mm512_srai_epi32(_mm512_slli_epi32(w, 16), 16);
+        default:
+            return _mm512_mask_i32gather_epi32(zero, valid, idx, val, 4);
+    }
+}
+
+__attribute__((target("avx512f")))
+MIP_ALWAYS_INLINE void DDAPacketAVX512Walk(const iftMIPVoxels *vox, const iftMIPBricks *bricks, iftMIPScratch *s,
+                                           iftMIPVoxelType type)
+{
+    int x[16], y[16], z[16], n[16], nmax, k;
+    long samples = 0, skipped = 0;
+    float dx[16], dy[16], dz[16];
+
+    LoadPacketSetup(s, 16, x, y, z, dx, dy, dz, n, &nmax);
+
+    __m512 px1 = _mm512_cvtepi32_ps(_mm512_loadu_si512(x));
+    __m512 py1 = _mm512_cvtepi32_ps(_mm512_loadu_si512(y));
+    __m512 pz1 = _mm512_cvtepi32_ps(_mm512_loadu_si512(z));
+    __m512i vn = _mm512_loadu_si512(n);
+    __m512 vdx = _mm512_loadu_ps(dx);
+    __m512 vdy = _mm512_loadu_ps(dy);
+    __m512 vdz = _mm512_loadu_ps(dz);
+    __m512i xlast = _mm512_set1_epi32(vox->size[0] - 1);
+    __m512i ylast = _mm512_set1_epi32(vox->size[1] - 1);
+    __m512i zlast = _mm512_set1_epi32(vox->size[2] - 1);
+    __m512 fxlast = _mm512_set1_ps(vox->size[0] - 1);
+    __m512 fylast = _mm512_set1_ps(vox->size[1] - 1);
+    __m512 fzlast = _mm512_set1_ps(vox->size[2] - 1);
+    __m512i one = _mm512_set1_epi32(1);
+    __m512 fzero = _mm512_setzero_ps();
+    __m512i zero = _mm512_setzero_si512();
+    __m512 vmax = fzero;
+    __m512 volmax = _mm512_set1_ps(bricks ? bricks->volmax : FLT_MAX);
+    __m512i nbx = _mm512_set1_epi32(bricks ? bricks->nbx : 0);
+    __m512i nbxy = _mm512_set1_epi32(bricks ? bricks->nbx * bricks->nby : 0);
+    __mmask16 early = 0;
+
+    for (k = 0; k < nmax; k++)
+    {
+        __m512 t = _mm512_set1_ps((float) k);
+        __m512 px = _mm512_add_ps(px1, _mm512_mul_ps(t, vdx));
+        __m512 py = _mm512_add_ps(py1, _mm512_mul_ps(t, vdy));
+        __m512 pz = _mm512_add_ps(pz1, _mm512_mul_ps(t, vdz));
+
+        __mmask16 inray = _mm512_cmpgt_epi32_mask(vn, _mm512_set1_epi32(k));
+        __mmask16 valid = inray & _mm512_cmp_ps_mask(volmax, vmax, _CMP_GT_OQ);
+
+        early |= inray & ~valid;
+        if (valid == 0)
+            break;
+
+        valid &= _mm512_cmp_ps_mask(px, fzero, _CMP_GE_OQ) & _mm512_cmp_ps_mask(px, fxlast, _CMP_LE_OQ);
+        valid &= _mm512_cmp_ps_mask(py, fzero, _CMP_GE_OQ) & _mm512_cmp_ps_mask(py, fylast, _CMP_LE_OQ);
+        valid &= _mm512_cmp_ps_mask(pz, fzero, _CMP_GE_OQ) & _mm512_cmp_ps_mask(pz, fzlast, _CMP_LE_OQ);
+
+        __m512i ix = _mm512_cvttps_epi32(px), iy = _mm512_cvttps_epi32(py), iz = _mm512_cvttps_epi32(pz);
+
+        if (bricks != NULL)
+        {
+            __m512i bidx = _mm512_add_epi32(_mm512_srli_epi32(ix, MIP_BRICK_LOG),
+                           _mm512_add_epi32(_mm512_mullo_epi32(_mm512_srli_epi32(iy, MIP_BRICK_LOG), nbx),
+                                            _mm512_mullo_epi32(_mm512_srli_epi32(iz, MIP_BRICK_LOG), nbxy)));
+            __m512 bmax = _mm512_cvtepi32_ps(_mm512_mask_i32gather_epi32(zero, valid, bidx, bricks->max, 4));
+
+            skipped += __builtin_popcount(valid);
+            valid &= _mm512_cmp_ps_mask(bmax, vmax, _CMP_GT_OQ);
+            skipped -= __builtin_popcount(valid);
+        }
+        if (valid == 0)
+            continue;
+        samples += __builtin_popcount(valid);
+
+        __m512i tx = AxisTermAVX512(vox, ix, 0), ty = AxisTermAVX512(vox, iy, 1), tz = AxisTermAVX512(vox, iz, 2);
+        __m512i idx = _mm512_add_epi32(tx, _mm512_add_epi32(ty, tz));
+        __m512i sx = _mm512_maskz_sub_epi32(_mm512_cmpgt_epi32_mask(xlast, ix),
+                                            AxisTermAVX512(vox, _mm512_add_epi32(ix, one), 0), tx);
+        __m512i sy = _mm512_maskz_sub_epi32(_mm512_cmpgt_epi32_mask(ylast, iy),
+                                            AxisTermAVX512(vox, _mm512_add_epi32(iy, one), 1), ty);
+        __m512i sz = _mm512_maskz_sub_epi32(_mm512_cmpgt_epi32_mask(zlast, iz),
+                                            AxisTermAVX512(vox, _mm512_add_epi32(iz, one), 2), tz);
+        __m512 fx = _mm512_sub_ps(px, _mm512_cvtepi32_ps(ix));
+        __m512 fy = _mm512_sub_ps(py, _mm512_cvtepi32_ps(iy));
+        __m512 fz = _mm512_sub_ps(pz, _mm512_cvtepi32_ps(iz));
+        __m512 J;
+
+#if MIP_NEAREST
+        __m512 half = _mm512_set1_ps(0.5);
+        idx = _mm512_mask_add_epi32(idx, _mm512_cmp_ps_mask(fx, half, _CMP_GE_OQ), idx, sx);
+        idx = _mm512_mask_add_epi32(idx, _mm512_cmp_ps_mask(fy, half, _CMP_GE_OQ), idx, sy);
+        idx = _mm512_mask_add_epi32(idx, _mm512_cmp_ps_mask(fz, half, _CMP_GE_OQ), idx, sz);
+        J = _mm512_cvtepi32_ps(GatherAVX512(vox->val, idx, valid, type));
+#else
+#define MIP_GATHER16(off) _mm512_cvtepi32_ps(GatherAVX512(vox->val, _mm512_add_epi32(idx, off), valid, type))
+        __m512i sxy = _mm512_add_epi32(sx, sy);
+        __m512 v000 = MIP_GATHER16(zero), v100 = MIP_GATHER16(sx);
+        __m512 v010 = MIP_GATHER16(sy), v110 = MIP_GATHER16(sxy);
+        __m512 v001 = MIP_GATHER16(sz), v101 = MIP_GATHER16(_mm512_add_epi32(sx, sz));
+        __m512 v011 = MIP_GATHER16(_mm512_add_epi32(sy, sz)), v111 = MIP_GATHER16(_mm512_add_epi32(sxy, sz));
+#undef MIP_GATHER16
+        __m512 c00 = _mm512_add_ps(v000, _mm512_mul_ps(fx, _mm512_sub_ps(v100, v000)));
+        __m512 c10 = _mm512_add_ps(v010, _mm512_mul_ps(fx, _mm512_sub_ps(v110, v010)));
+        __m512 c01 = _mm512_add_ps(v001, _mm512_mul_ps(fx, _mm512_sub_ps(v101, v001)));
+        __m512 c11 = _mm512_add_ps(v011, _mm512_mul_ps(fx, _mm512_sub_ps(v111, v011)));
+        __m512 c0 = _mm512_add_ps(c00, _mm512_mul_ps(fy, _mm512_sub_ps(c10, c00)));
+        __m512 c1 = _mm512_add_ps(c01, _mm512_mul_ps(fy, _mm512_sub_ps(c11, c01)));
+        J = _mm512_add_ps(c0, _mm512_mul_ps(fz, _mm512_sub_ps(c1, c0)));
+#endif
+        vmax = _mm512_mask_max_ps(vmax, valid, vmax, J);
+    }
+
+    _mm512_storeu_si512(s->max, _mm512_cvttps_epi32(_mm512_add_ps(vmax, _mm512_set1_ps(0.5))));
+    s->count.samples += samples;
+    s->count.skipped += skipped;
+    s->count.early += __builtin_popcount(early);
+}
+
+__attribute__((target("avx512f")))
+void DDAPacketAVX512(const iftMIPVoxels *vox, const iftMIPBricks *bricks, iftMIPScratch *s)
+{
+    switch (vox->type)
+    {
+        case MIP_VOXEL_UINT8:  DDAPacketAVX512Walk(vox, bricks, s, MIP_VOXEL_UINT8); break;
+        case MIP_VOXEL_UINT16: DDAPacketAVX512Walk(vox, bricks, s, MIP_VOXEL_UINT16); break;
+        case MIP_VOXEL_INT16:  DDAPacketAVX512Walk(vox, bricks, s, MIP_VOXEL_INT16); break;
+        default:               DDAPacketAVX512Walk(vox, bricks, s, MIP_VOXEL_INT32); break;
+    }
+}
+#endif
+
+/* picks the widest packet kernel the CPU supports; MIP_ISA=scalar|avx2|avx512 caps the choice */
+iftMIPKernel SelectMIPKernel(void)
+{
+    iftMIPKernel scalar = {"scalar", 1, DDAPacketScalar};
+    const char *isa = getenv("MIP_ISA");
+
+#if MIP_HAVE_X86_SIMD
+    iftMIPKernel avx2   = {"avx2", 8, DDAPacketAVX2};
+    iftMIPKernel avx512 = {"avx512", 16, DDAPacketAVX512};
+
+    __builtin_cpu_init();
+    if (isa != NULL && strcmp(isa, "scalar") == 0)
+        return scalar;
+    if ((isa == NULL || strcmp(isa, "avx512") == 0) && __builtin_cpu_supports("avx512f"))
+        return avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return avx2;
+#else
+    (void) isa;
+#endif
+
+    return scalar;
+}
+
+/* the kernel that walks rays as opt->traversal and opt->lmip ask */
+iftMIPKernel RayKernel(const iftMIPOptions *opt)
+{
+    iftMIPKernel exact = {"exact", MIP_SCALAR_WIDTH, ExactPacket};
+    iftMIPKernel lmip = {"lmip", MIP_SCALAR_WIDTH, LMIPPacket};
+
+    if (opt->lmip && opt->traversal != MIP_TRAVERSAL_DDA)
+        iftError("The local MIP walks rays with the DDA traversal", "RayKernel");
+    if (opt->lmip)
+        return lmip;
+
+    return (opt->traversal == MIP_TRAVERSAL_EXACT) ? exact : SelectMIPKernel();
+}
+
+/* the scratch of each of nthreads threads, carrying what the kernels take from opt */
+iftMIPScratch *CreateMIPScratch(int nthreads, const iftMIPOptions *opt)
+{
+    int t;
+    iftMIPScratch *scratch = (iftMIPScratch *) calloc(nthreads, sizeof(iftMIPScratch));
+
+    for (t = 0; t < nthreads; t++)
+        scratch[t].threshold = opt->threshold;
+
+    return scratch;
+}
+
+
+iftVector ZeroAlmostZero(iftVector v)
+{
+    v.x = iftAlmostZero(v.x) ? 0.0 : v.x;
+    v.y = iftAlmostZero(v.y) ? 0.0 : v.y;
+    v.z = iftAlmostZero(v.z) ? 0.0 : v.z;
+
+    return v;
+}
+
+
+/* clips the line o + t*d, t unbounded, to the slab [lo, hi] of one axis. A line parallel to
+   the slab (d == 0) keeps every t when it runs inside it, faces included, and none otherwise;
+   the selects take the place of branches, so lane loops over it vectorize */
+MIP_ALWAYS_INLINE void ClipSlab(float o, float d, float lo, float hi, float *t0, float *t1)
+{
+    float ta = (lo - o) / d, tb = (hi - o) / d;
+    float inside = (o >= lo && o <= hi) ? FLT_MAX : -FLT_MAX;
+    float enter = (d != 0) ? fminf(ta, tb) : -inside;
+    float leave = (d != 0) ? fmaxf(ta, tb) : inside;
+
+    *t0 = fmaxf(*t0, enter);
+    *t1 = fminf(*t1, leave);
+}
+
+/* the voxel of the box point o + t*d, taking the half voxel outside the centres on each face
+   as the border voxel */
+static inline iftVoxel BoxVoxel(iftVector o, iftVector d, float t, const iftImage *img)
+{
+    iftVoxel p;
+
+    p.x = iftMax(0, iftMin(img->xsize - 1, (int) (o.x + t * d.x)));
+    p.y = iftMax(0, iftMin(img->ysize - 1, (int) (o.y + t * d.y)));
+    p.z = iftMax(0, iftMin(img->zsize - 1, (int) (o.z + t * d.z)));
+
+    return p;
+}
+
+/* slab method: clips the ray Tpo + t*Tn, t unbounded, to the box [-0.5, size - 0.5] covered by
+   the voxels and returns its entry and exit parameters in t0 <= t1, or 0 when it misses.
+   Rays that graze an edge or corner hit it; components of Tn that are almost zero count as zero */
+int ClipRayToVolume(iftVector Tpo, const iftImage *img, iftVector Tn, float *t0, float *t1)
+{
+    iftVector n = ZeroAlmostZero(Tn);
+
+    *t0 = -FLT_MAX;
+    *t1 = FLT_MAX;
+    ClipSlab(Tpo.x, n.x, -0.5f, img->xsize - 0.5f, t0, t1);
+    ClipSlab(Tpo.y, n.y, -0.5f, img->ysize - 0.5f, t0, t1);
+    ClipSlab(Tpo.z, n.z, -0.5f, img->zsize - 0.5f, t0, t1);
+
+    return *t0 <= *t1;
+}
+
+/* the first (p1) and last (pn) voxels of the ray Tpo + t*Tn inside the volume */
+int ComputeIntersection(iftVector Tpo, iftImage *img, iftVector Tn, iftVoxel *p1, iftVoxel *pn)
+{
+    float t0, t1;
+    iftVector n = ZeroAlmostZero(Tn);
+
+    if (!ClipRayToVolume(Tpo, img, Tn, &t0, &t1))
+        return 0;
+
+    *p1 = BoxVoxel(Tpo, n, t0, img);
+    *pn = BoxVoxel(Tpo, n, t1, img);
+
+    return 1;
+}
+
+iftMatrix *voxelToMatrix(iftVoxel v)
+{
+    iftMatrix *voxMat = iftCreateMatrix(1, 4);
+    iftMatrixElem(voxMat, 0, 0) = v.x;
+    iftMatrixElem(voxMat, 0, 1) = v.y;
+    iftMatrixElem(voxMat, 0, 2) = v.z;
+    iftMatrixElem(voxMat, 0, 3) = 1;
+
+    return voxMat;
+}
+
+/* reads base/du/dv/dir off the columns of T, so no matrix product is needed per pixel */
+iftRaySetup createRaySetup(iftMatrix *T, float diagonal)
+{
+    iftRaySetup rs;
+
+    rs.du.x = iftMatrixElem(T, 0, 0);
+    rs.du.y = iftMatrixElem(T, 0, 1);
+    rs.du.z = iftMatrixElem(T, 0, 2);
+
+    rs.dv.x = iftMatrixElem(T, 1, 0);
+    rs.dv.y = iftMatrixElem(T, 1, 1);
+    rs.dv.z = iftMatrixElem(T, 1, 2);
+
+    rs.base.x = iftMatrixElem(T, 2, 0) * (diagonal / 2) + iftMatrixElem(T, 3, 0);
+    rs.base.y = iftMatrixElem(T, 2, 1) * (diagonal / 2) + iftMatrixElem(T, 3, 1);
+    rs.base.z = iftMatrixElem(T, 2, 2) * (diagonal / 2) + iftMatrixElem(T, 3, 2);
+
+    rs.dir.x = -iftMatrixElem(T, 2, 0);
+    rs.dir.y = -iftMatrixElem(T, 2, 1);
+    rs.dir.z = -iftMatrixElem(T, 2, 2);
+
+    rs.perspective = 0;
+    rs.eye.x = rs.eye.y = rs.eye.z = 0;
+    rs.tnear = -FLT_MAX;
+    rs.tfar = FLT_MAX;
+    rs.xsize = rs.ysize = diagonal;
+    rs.umin = rs.vmin = 0;
+    rs.umax = rs.xsize;
+    rs.vmax = rs.ysize;
+
+    return rs;
+}
+
+iftVector RayOrigin(const iftRaySetup *rs, int u, int v)
+{
+    iftVector o;
+
+    o.x = rs->base.x + u * rs->du.x + v * rs->dv.x;
+    o.y = rs->base.y + u * rs->du.y + v * rs->dv.y;
+    o.z = rs->base.z + u * rs->du.z + v * rs->dv.z;
+
+    return o;
+}
+
+iftRaySetup ViewRaySetup(iftImage *img, float xtheta, float ytheta)
+{
+    iftMatrix *T = createTransformationMatrix(img, xtheta, ytheta);
+    iftRaySetup rs = createRaySetup(T, VolumeDiagonal(img));
+
+    iftDestroyMatrix(&T);
+
+    return rs;
+}
+
+static iftVector UnitVector(iftVector v)
+{
+    float len = iftVectorMagnitude(v);
+
+    v.x /= len; v.y /= len; v.z /= len;
+
+    return v;
+}
+
+/* v turned as the orthographic view rs turns the volume, whose z axis goes to -rs->dir */
+static iftVector TurnByView(const iftRaySetup *rs, iftVector v)
+{
+    iftVector w;
+
+    w.x = v.x * rs->du.x + v.y * rs->dv.x - v.z * rs->dir.x;
+    w.y = v.x * rs->du.y + v.y * rs->dv.y - v.z * rs->dir.y;
+    w.z = v.x * rs->du.z + v.y * rs->dv.z - v.z * rs->dir.z;
+
+    return w;
+}
+
+/* perspective rays of cam, whose coordinates and distances are scaled by scale for the volume
+   img, turned about its centre by the view (xtheta, ytheta). The corners of the volume box are
+   projected to bound the pixels whose rays can hit it; the whole image when one lies behind
+   the eye, as in fly-throughs */
+iftRaySetup CameraRaySetup(iftImage *img, const iftMIPCamera *cam, float xtheta, float ytheta, float scale)
+{
+    iftRaySetup view = ViewRaySetup(img, xtheta, ytheta), rs;
+    iftVector c = {.x = img->xsize / 2.0, .y = img->ysize / 2.0, .z = img->zsize / 2.0};
+    iftVector eye = {.x = cam->eye.x * scale - c.x, .y = cam->eye.y * scale - c.y, .z = cam->eye.z * scale - c.z};
+    iftVector at = {.x = cam->at.x * scale - c.x, .y = cam->at.y * scale - c.y, .z = cam->at.z * scale - c.z};
+    iftVector up = TurnByView(&view, cam->up), f, r, d, t;
+    float s, cu = (cam->xsize - 1) / 2.0, cv = (cam->ysize - 1) / 2.0;
+    float umin = FLT_MAX, vmin = FLT_MAX, umax = -FLT_MAX, vmax = -FLT_MAX;
+    int k, behind = 0;
+
+    if (cam->xsize <= 0 || cam->ysize <= 0 || cam->fov <= 0 || cam->fov >= 180)
+        iftError("Invalid camera image size or field of view", "CameraRaySetup");
+
+    eye = TurnByView(&view, eye);
+    eye.x += c.x; eye.y += c.y; eye.z += c.z;
+    at = TurnByView(&view, at);
+    at.x += c.x; at.y += c.y; at.z += c.z;
+
+    t = (iftVector) iftVectorSub(at, eye);
+    if (iftVectorMagnitude(t) < IFT_EPSILON)
+        iftError("The camera looks at its own eye", "CameraRaySetup");
+    f = UnitVector(t);
+    t = (iftVector) iftVectorCrossProd(up, f);
+    if (iftVectorMagnitude(t) < IFT_EPSILON)
+        iftError("The camera up vector is along the viewing direction", "CameraRaySetup");
+    r = UnitVector(t);
+    d = (iftVector) iftVectorCrossProd(r, f);
+
+    s = 2 * tanf(cam->fov * IFT_PI / 360.0) / cam->ysize;
+    rs.du = (iftVector) iftVectorScalarProd(r, s);
+    rs.dv = (iftVector) iftVectorScalarProd(d, s);
+    rs.base.x = f.x - cu * rs.du.x - cv * rs.dv.x;
+    rs.base.y = f.y - cu * rs.du.y - cv * rs.dv.y;
+    rs.base.z = f.z - cu * rs.du.z - cv * rs.dv.z;
+    rs.dir = f;
+    rs.perspective = 1;
+    rs.eye = eye;
+    rs.tnear = cam->near * scale;
+    rs.tfar = (cam->far < FLT_MAX) ? cam->far * scale : FLT_MAX;
+    rs.xsize = cam->xsize;
+    rs.ysize = cam->ysize;
+
+    for (k = 0; k < 8 && !behind; k++)
+    {
+        iftVector q = {.x = ((k & 1) ? img->xsize - 0.5f : -0.5f) - eye.x,
+                       .y = ((k & 2) ? img->ysize - 0.5f : -0.5f) - eye.y,
+                       .z = ((k & 4) ? img->zsize - 0.5f : -0.5f) - eye.z};
+        float z = iftVectorInnerProduct(q, f);
+
+        if (z <= IFT_EPSILON)
+            behind = 1;
+        else
+        {
+            float pu = iftVectorInnerProduct(q, r) / (z * s) + cu, pv = iftVectorInnerProduct(q, d) / (z * s) + cv;
+
+            umin = fminf(umin, pu); umax = fmaxf(umax, pu);
+            vmin = fminf(vmin, pv); vmax = fmaxf(vmax, pv);
+        }
+    }
+
+    if (behind)
+    {
+        rs.umin = rs.vmin = 0;
+        rs.umax = rs.xsize;
+        rs.vmax = rs.ysize;
+    }
+    else
+    {
+        /* a pixel of margin on each side absorbs rounding */
+        rs.umin = fmaxf(0, fminf(rs.xsize, floorf(umin) - 1));
+        rs.umax = fmaxf(0, fminf(rs.xsize, ceilf(umax) + 2));
+        rs.vmin = fmaxf(0, fminf(rs.ysize, floorf(vmin) - 1));
+        rs.vmax = fmaxf(0, fminf(rs.ysize, ceilf(vmax) + 2));
+    }
+
+    return rs;
+}
+
+/* the rays of a frame: opt->camera turned by the view, or the orthographic view itself. img
+   is the volume at opt->level, which the camera is scaled to */
+iftRaySetup FrameRaySetup(iftImage *img, float xtheta, float ytheta, const iftMIPOptions *opt)
+{
+    if (opt->camera != NULL)
+        return CameraRaySetup(img, opt->camera, xtheta, ytheta, 1.0 / (1 << opt->level));
+
+    return ViewRaySetup(img, xtheta, ytheta);
+}
+
+/* whether some pixel of the MIP_TILE_SIZE tile at (u0, v0) may see the volume */
+static int TileInFootprint(const iftRaySetup *rs, int u0, int v0)
+{
+    return u0 < rs->umax && u0 + MIP_TILE_SIZE > rs->umin && v0 < rs->vmax && v0 + MIP_TILE_SIZE > rs->vmin;
+}
+
+
+
+/* adds the counters of one thread to the statistics, which frames rendered in parallel share */
+void AddMIPCounters(iftMIPStats *stats, const iftMIPCounters *c)
+{
+    #pragma omp critical (mip_stats)
+    {
+        stats->count.rays += c->rays;
+        stats->count.hits += c->hits;
+        stats->count.samples += c->samples;
+        stats->count.skipped += c->skipped;
+        stats->count.early += c->early;
+        stats->count.pixels += c->pixels;
+        stats->count.walked += c->walked;
+        stats->count.length += c->length;
+    }
+}
+
+/* adds the time since t0, taken with omp_get_wtime(), to the phase total *ms */
+void AddMIPTime(float *ms, double t0)
+{
+    float dt = 1000.0 * (omp_get_wtime() - t0);
+
+    #pragma omp atomic
+    *ms += dt;
+}
+
+/* prints the render progress every 10%, from whichever thread crosses the mark;
+   done == NULL keeps the render quiet */
+void ReportProgress(int *done, int total)
+{
+    int before, after;
+
+    if (done == NULL)
+        return;
+
+    #pragma omp atomic capture
+    before = (*done)++;
+    after = before + 1;
+
+    if ((10 * after) / total != (10 * before) / total)
+    {
+        #pragma omp critical (mip_progress)
+        {
+            printf("Progress : %d%%\n", (100 * after) / total);
+            fflush(stdout);
+        }
+    }
+}
+
+/* the origin and the unit direction, almost zero components zeroed, of the ray of pixel (u, v) */
+static inline void PixelRay(const iftRaySetup *rs, int u, int v, iftVector *o, iftVector *n)
+{
+    if (rs->perspective)
+    {
+        *o = rs->eye;
+        *n = ZeroAlmostZero(UnitVector(RayOrigin(rs, u, v)));
+    }
+    else
+    {
+        *o = RayOrigin(rs, u, v);
+        *n = ZeroAlmostZero(rs->dir);
+    }
+}
+
+/* ComputeIntersection() for the w pixels of row v from u, limited to [rs->tnear, rs->tfar], into
+   the packet of the scratch. The clipping runs as lane loops over arrays, which the compiler
+   vectorizes across the packet */
+static void ClipRayRow(const iftRaySetup *rs, iftImage *img, int u, int v, int w, iftMIPScratch *s)
+{
+    float ox[MIP_MAX_PACKET], oy[MIP_MAX_PACKET], oz[MIP_MAX_PACKET];
+    float nx[MIP_MAX_PACKET], ny[MIP_MAX_PACKET], nz[MIP_MAX_PACKET];
+    float t0[MIP_MAX_PACKET], t1[MIP_MAX_PACKET];
+    int i;
+
+    for (i = 0; i < w; i++)
+    {
+        iftVector o, n;
+
+        PixelRay(rs, u + i, v, &o, &n);
+        ox[i] = o.x; oy[i] = o.y; oz[i] = o.z;
+        nx[i] = n.x; ny[i] = n.y; nz[i] = n.z;
+        t0[i] = rs->tnear;
+        t1[i] = rs->tfar;
+    }
+    for (i = 0; i < w; i++)
+        ClipSlab(ox[i], nx[i], -0.5f, img->xsize - 0.5f, &t0[i], &t1[i]);
+    for (i = 0; i < w; i++)
+        ClipSlab(oy[i], ny[i], -0.5f, img->ysize - 0.5f, &t0[i], &t1[i]);
+    for (i = 0; i < w; i++)
+        ClipSlab(oz[i], nz[i], -0.5f, img->zsize - 0.5f, &t0[i], &t1[i]);
+
+    for (i = 0; i < w; i++)
+    {
+        iftVector o = {.x = ox[i], .y = oy[i], .z = oz[i]};
+        iftVector n = {.x = nx[i], .y = ny[i], .z = nz[i]};
+
+        s->dir[i] = n;
+        s->hit[i] = (t0[i] <= t1[i]);
+        if (s->hit[i])
+        {
+            s->p1[i] = BoxVoxel(o, n, t0[i], img);
+            s->pn[i] = BoxVoxel(o, n, t1[i], img);
+            s->enter[i].x = o.x + t0[i] * n.x;
+            s->enter[i].y = o.y + t0[i] * n.y;
+            s->enter[i].z = o.z + t0[i] * n.z;
+            s->span[i] = t1[i] - t0[i];
+            s->near[i] = t0[i];
+        }
+    }
+}
+
+/* ClipRayRow() for the single pixel (u, v), into lane i */
+static void ClipPixelRay(const iftRaySetup *rs, iftImage *img, int u, int v, int i, iftMIPScratch *s)
+{
+    iftVector o, n;
+    float t0 = rs->tnear, t1 = rs->tfar;
+
+    PixelRay(rs, u, v, &o, &n);
+    ClipSlab(o.x, n.x, -0.5f, img->xsize - 0.5f, &t0, &t1);
+    ClipSlab(o.y, n.y, -0.5f, img->ysize - 0.5f, &t0, &t1);
+    ClipSlab(o.z, n.z, -0.5f, img->zsize - 0.5f, &t0, &t1);
+
+    s->dir[i] = n;
+    s->hit[i] = (t0 <= t1);
+    if (s->hit[i])
+    {
+        s->p1[i] = BoxVoxel(o, n, t0, img);
+        s->pn[i] = BoxVoxel(o, n, t1, img);
+        s->enter[i].x = o.x + t0 * n.x;
+        s->enter[i].y = o.y + t0 * n.y;
+        s->enter[i].z = o.z + t0 * n.z;
+        s->span[i] = t1 - t0;
+        s->near[i] = t0;
+    }
+}
+
+void RenderTile(iftImage *img, const iftMIPVoxels *vox, const iftMIPBricks *bricks, iftImage *output,
+                const iftRaySetup *rs, const iftMIPKernel *kernel, int u0, int v0,
+                iftMIPScratch *s)
+{
+    int u, v, p, i, w;
+    int u1 = iftMin(u0 + MIP_TILE_SIZE, rs->umax);
+    int v1 = iftMin(v0 + MIP_TILE_SIZE, rs->vmax);
+
+    u0 = iftMax(u0, rs->umin);
+    v0 = iftMax(v0, rs->vmin);
+
+    for (v = v0; v < v1; v++)
+    {
+        for (u = u0; u < u1; u += kernel->width)
+        {
+            w = iftMin(kernel->width, u1 - u);
+            ClipRayRow(rs, img, u, v, w, s);
+            for (i = w; i < kernel->width; i++)
+                s->hit[i] = 0;
+
+            kernel->packet(vox, bricks, s);
+
+            s->count.rays += w;
+            for (i = 0; i < w; i++)
+                s->count.hits += s->hit[i];
+
+            p = u + output->tby[v];
+            for (i = 0; i < w; i++)
+                output->val[p + i] = s->max[i];
+        }
+    }
+}
+
+/* receives each pass of a progressive render; view stays owned by the renderer */
+typedef void (*iftMIPProgressFunc)(const iftImage *view, int pass, int npasses, void *user);
+
+/* casts the n rays queued in the scratch, whose output pixels are in s->pix */
+static void CastPixelPacket(const iftMIPVoxels *vox, const iftMIPBricks *bricks, iftImage *output,
+                            const iftMIPKernel *kernel, int n, iftMIPScratch *s)
+{
+    int i;
+
+    for (i = n; i < kernel->width; i++)
+        s->hit[i] = 0;
+    kernel->packet(vox, bricks, s);
+
+    s->count.rays += n;
+    for (i = 0; i < n; i++)
+    {
+        s->count.hits += s->hit[i];
+        output->val[s->pix[i]] = s->max[i];
+    }
+}
+
+/* casts the rays of the tile at (u0, v0) that lie on the lattice of spacing step but were not
+   cast by the pass before (spacing 2 * step, none when step == first), then fills the other
+   pixels with the lattice sample above and to the left of them */
+void RenderTilePass(iftImage *img, const iftMIPVoxels *vox, const iftMIPBricks *bricks, iftImage *output,
+                    const iftRaySetup *rs, const iftMIPKernel *kernel, int u0, int v0,
+                    int step, int first, iftMIPScratch *s)
+{
+    int u, v, n = 0;
+    int u1 = iftMin(u0 + MIP_TILE_SIZE, output->xsize);
+    int v1 = iftMin(v0 + MIP_TILE_SIZE, output->ysize);
+
+    for (v = v0; v < v1; v += step)
+        for (u = u0; u < u1; u += step)
+        {
+            if (step < first && u % (2 * step) == 0 && v % (2 * step) == 0)
+                continue;
+            s->pix[n] = u + output->tby[v];
+            ClipPixelRay(rs, img, u, v, n, s);
+            if (++n == kernel->width)
+            {
+                CastPixelPacket(vox, bricks, output, kernel, n, s);
+                n = 0;
+            }
+        }
+    if (n > 0)
+        CastPixelPacket(vox, bricks, output, kernel, n, s);
+
+    if (step > 1)
+        for (v = v0; v < v1; v++)
+            for (u = u0; u < u1; u++)
+                if (u % step != 0 || v % step != 0)
+                    output->val[u + output->tby[v]] = output->val[u - u % step + output->tby[v - v % step]];
+}
+
+/* a rectangle of an adaptive tile with rays cast at its corners (ua, va) and (ub, vb) */
+typedef struct mip_cell
+{
+    short ua, va, ub, vb;
+}iftMIPCell;
+
+/* queues the ray of pixel (u, v) of the tile at (u0, v0) unless it is cast already, casting the
+   queue once it fills a packet */
+static void QueueTileRay(iftImage *img, const iftMIPVoxels *vox, const iftMIPBricks *bricks, iftImage *output,
+                         const iftRaySetup *rs, const iftMIPKernel *kernel, uint8_t *cast,
+                         int u0, int v0, int u, int v, int *n, iftMIPScratch *s)
+{
+    if (cast[(u - u0) + (v - v0) * MIP_TILE_SIZE])
+        return;
+    cast[(u - u0) + (v - v0) * MIP_TILE_SIZE] = 1;
+
+    s->pix[*n] = u + output->tby[v];
+    ClipPixelRay(rs, img, u, v, *n, s);
+    if (++(*n) == kernel->width)
+    {
+        CastPixelPacket(vox, bricks, output, kernel, *n, s);
+        *n = 0;
+    }
+}
+
+/* renders the tile at (u0, v0) from rays cast every MIP_ADAPTIVE_STEP pixels; a cell whose
+   corners differ by more than tolerance is split in four with rays cast at the new corners, one
+   level of cells at a time so that packets stay full, and the others are filled bilinearly */
+void RenderTileAdaptive(iftImage *img, const iftMIPVoxels *vox, const iftMIPBricks *bricks, iftImage *output,
+                        const iftRaySetup *rs, const iftMIPKernel *kernel, int u0, int v0,
+                        int tolerance, iftMIPScratch *s)
+{
+    iftMIPCell cells[2][MIP_TILE_SIZE * MIP_TILE_SIZE], *c;
+    uint8_t cast[MIP_TILE_SIZE * MIP_TILE_SIZE] = {0};
+    int u1 = iftMin(u0 + MIP_TILE_SIZE, output->xsize) - 1;
+    int v1 = iftMin(v0 + MIP_TILE_SIZE, output->ysize) - 1;
+    int ua, va, ub, vb, um, vm, u, v, i, n = 0, ncells = 0, nnext, cur = 0;
+
+    /* the coarse lattice, closed by the last row and column of the tile */
+    va = v0;
+    do
+    {
+        vb = iftMin(va + MIP_ADAPTIVE_STEP, v1);
+        ua = u0;
+        do
+        {
+            ub = iftMin(ua + MIP_ADAPTIVE_STEP, u1);
+            cells[cur][ncells++] = (iftMIPCell) {ua, va, ub, vb};
+            QueueTileRay(img, vox, bricks, output, rs, kernel, cast, u0, v0, ua, va, &n, s);
+            QueueTileRay(img, vox, bricks, output, rs, kernel, cast, u0, v0, ub, va, &n, s);
+            QueueTileRay(img, vox, bricks, output, rs, kernel, cast, u0, v0, ua, vb, &n, s);
+            QueueTileRay(img, vox, bricks, output, rs, kernel, cast, u0, v0, ub, vb, &n, s);
+            ua = ub;
+        } while (ua < u1);
+        va = vb;
+    } while (va < v1);
+
+    while (ncells > 0)
+    {
+        if (n > 0)
+            CastPixelPacket(vox, bricks, output, kernel, n, s);
+        n = nnext = 0;
+
+        for (i = 0; i < ncells; i++)
+        {
+            int q[4], lo, hi;
+
+            c = &cells[cur][i];
+            if (c->ub - c->ua <= 1 && c->vb - c->va <= 1)
+                continue;
+
+            q[0] = output->val[c->ua + output->tby[c->va]];
+            q[1] = output->val[c->ub + output->tby[c->va]];
+            q[2] = output->val[c->ua + output->tby[c->vb]];
+            q[3] = output->val[c->ub + output->tby[c->vb]];
+            lo = iftMin(iftMin(q[0], q[1]), iftMin(q[2], q[3]));
+            hi = iftMax(iftMax(q[0], q[1]), iftMax(q[2], q[3]));
+
+            if (hi - lo <= tolerance)
+            {
+                for (v = c->va; v <= c->vb; v++)
+                    for (u = c->ua; u <= c->ub; u++)
+                    {
+                        float fu = (c->ub > c->ua) ? (float) (u - c->ua) / (c->ub - c->ua) : 0;
+                        float fv = (c->vb > c->va) ? (float) (v - c->va) / (c->vb - c->va) : 0;
+
+                        if (!cast[(u - u0) + (v - v0) * MIP_TILE_SIZE])
+                            output->val[u + output->tby[v]] =
+                                (int) ((q[0] * (1 - fu) + q[1] * fu) * (1 - fv) + (q[2] * (1 - fu) + q[3] * fu) * fv + 0.5f);
+                    }
+                continue;
+            }
+
+            um = (c->ub - c->ua > 1) ? (c->ua + c->ub) / 2 : c->ua;
+            vm = (c->vb - c->va > 1) ? (c->va + c->vb) / 2 : c->va;
+            QueueTileRay(img, vox, bricks, output, rs, kernel, cast, u0, v0, um, c->va, &n, s);
+            QueueTileRay(img, vox, bricks, output, rs, kernel, cast, u0, v0, um, c->vb, &n, s);
+            QueueTileRay(img, vox, bricks, output, rs, kernel, cast, u0, v0, c->ua, vm, &n, s);
+            QueueTileRay(img, vox, bricks, output, rs, kernel, cast, u0, v0, c->ub, vm, &n, s);
+            QueueTileRay(img, vox, bricks, output, rs, kernel, cast, u0, v0, um, vm, &n, s);
+
+            /* two or four halves, as a side of one pixel is not split */
+            for (v = 0; v <= (vm > c->va); v++)
+                for (u = 0; u <= (um > c->ua); u++)
+                    cells[1 - cur][nnext++] = (iftMIPCell) {(u == 0) ? c->ua : um, (v == 0) ? c->va : vm,
+                                                            (u == 0 && um > c->ua) ? um : c->ub,
+                                                            (v == 0 && vm > c->va) ? vm : c->vb};
+        }
+
+        cur = 1 - cur;
+        ncells = nnext;
+    }
+}
+
+/* renders the diag x diag view in MIP_TILE_SIZE tiles, scheduled across nthreads threads;
+   vox may be NULL to read img->val directly, and bricks NULL to disable empty-space skipping.
+   With tolerance > 0 the tiles are sampled adaptively (see RenderTileAdaptive()). Even cells with
+   equal corners may hide a structure thinner than a cell, so 0 casts every ray */
+iftImage *MaximumIntensityProjectionThreads(iftImage *img, const iftMIPVoxels *vox, const iftMIPBricks *bricks,
+                                            float xtheta, float ytheta, int tolerance, const iftMIPOptions *opt)
+{
+    iftMIPVoxels *linear = (vox == NULL) ? CreateMIPVoxels(img, 0, MIP_VOXEL_INT32) : NULL;
+    int Nu, Nv, ntu, ntv, ntiles, t, done = 0;
+    int nthreads = opt->nthreads;
+
+    iftRaySetup rs;
+    iftMIPScratch *scratch;
+    iftMIPKernel kernel = RayKernel(opt);
+
+    if (nthreads <= 0)
+        nthreads = omp_get_max_threads();
+
+    rs = FrameRaySetup(img, xtheta, ytheta, opt);
+    Nu = rs.xsize;
+    Nv = rs.ysize;
+    iftImage *output = iftCreateImage(Nu, Nv, 1);
+
+    scratch = CreateMIPScratch(nthreads, opt);
+
+    ntu = (Nu + MIP_TILE_SIZE - 1) / MIP_TILE_SIZE;
+    ntv = (Nv + MIP_TILE_SIZE - 1) / MIP_TILE_SIZE;
+    ntiles = ntu * ntv;
+
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(nthreads)
+    for (t = 0; t < ntiles; t++)
+    {
+        int u0 = (t % ntu) * MIP_TILE_SIZE, v0 = (t / ntu) * MIP_TILE_SIZE;
+
+        /* tiles that cannot see the volume stay black */
+        if (TileInFootprint(&rs, u0, v0) && tolerance > 0)
+            RenderTileAdaptive(img, (vox != NULL) ? vox : linear, bricks, output, &rs, &kernel, u0, v0, tolerance,
+                               &scratch[omp_get_thread_num()]);
+        else if (TileInFootprint(&rs, u0, v0))
+            RenderTile(img, (vox != NULL) ? vox : linear, bricks, output, &rs, &kernel, u0, v0,
+                       &scratch[omp_get_thread_num()]);
+        ReportProgress(opt->verbose ? &done : NULL, ntiles);
+    }
+
+    if (opt->stats != NULL)
+        for (t = 0; t < nthreads; t++)
+            AddMIPCounters(opt->stats, &scratch[t].count);
+    if (opt->lmip && opt->verbose)
+    {
+        long walked = 0, length = 0;
+
+        for (t = 0; t < nthreads; t++)
+        {
+            walked += scratch[t].count.walked;
+            length += scratch[t].count.length;
+        }
+        printf("Local MIP : %.1f%% of the ray lengths traversed\n", (length > 0) ? 100.0 * walked / length : 0);
+    }
+
+    free(scratch);
+    DestroyMIPVoxels(&linear);
+
+    return output;
+}
+
+/* MaximumIntensityProjectionThreads() in passes: the first casts every MIP_PROGRESSIVE_STEP-th
+   ray along u and v, and each later one halves the spacing, until the last gives the full view.
+   emit gets every pass, upsampled to the full size, and runs on one thread while the others
+   go on with the next pass; it must be done with the view when it returns */
+iftImage *MaximumIntensityProjectionProgressive(iftImage *img, const iftMIPVoxels *vox, const iftMIPBricks *bricks,
+                                                float xtheta, float ytheta, const iftMIPOptions *opt,
+                                                iftMIPProgressFunc emit, void *user)
+{
+    iftMIPVoxels *linear = (vox == NULL) ? CreateMIPVoxels(img, 0, MIP_VOXEL_INT32) : NULL;
+    int ntu, ntiles, npasses = 1, t;
+    int nthreads = (opt->nthreads > 0) ? opt->nthreads : omp_get_max_threads();
+    iftRaySetup rs;
+    iftMIPScratch *scratch;
+    iftMIPKernel kernel = RayKernel(opt);
+    iftImage *output, *preview;
+
+    for (t = MIP_PROGRESSIVE_STEP; t > 1; t /= 2)
+        npasses++;
+
+    rs = FrameRaySetup(img, xtheta, ytheta, opt);
+    output = iftCreateImage(rs.xsize, rs.ysize, 1);
+    preview = iftCreateImage(rs.xsize, rs.ysize, 1);
+    scratch = CreateMIPScratch(nthreads, opt);
+    ntu = (rs.xsize + MIP_TILE_SIZE - 1) / MIP_TILE_SIZE;
+    ntiles = ntu * ((rs.ysize + MIP_TILE_SIZE - 1) / MIP_TILE_SIZE);
+
+    #pragma omp parallel num_threads(nthreads)
+    {
+        int pass, step, tile;
+
+        for (pass = 0, step = MIP_PROGRESSIVE_STEP; step >= 1; pass++, step /= 2)
+        {
+            /* the barrier after the previous pass also waits for emit to be done with preview */
+            #pragma omp for schedule(dynamic, 1)
+            for (tile = 0; tile < ntiles; tile++)
+                if (TileInFootprint(&rs, (tile % ntu) * MIP_TILE_SIZE, (tile / ntu) * MIP_TILE_SIZE))
+                    RenderTilePass(img, (vox != NULL) ? vox : linear, bricks, output, &rs, &kernel,
+                                   (tile % ntu) * MIP_TILE_SIZE, (tile / ntu) * MIP_TILE_SIZE, step,
+                                   MIP_PROGRESSIVE_STEP, &scratch[omp_get_thread_num()]);
+
+            if (emit != NULL && step > 1)
+            {
+                #pragma omp single
+                memcpy(preview->val, output->val, output->n * sizeof(int));
+                #pragma omp single nowait
+                emit(preview, pass + 1, npasses, user);
+            }
+        }
+    }
+    if (emit != NULL)
+        emit(output, npasses, npasses, user);
+
+    if (opt->stats != NULL)
+        for (t = 0; t < nthreads; t++)
+            AddMIPCounters(opt->stats, &scratch[t].count);
+
+    free(scratch);
+    DestroyMIPVoxels(&linear);
+    iftDestroyImage(&preview);
+
+    return output;
+}
+
+/* the images of a multi-output projection; those not asked for are NULL */
+typedef struct mip_projections
+{
+    iftImage *max, *min, *mean, *depth;
+}iftMIPProjections;
+
+/* the first image of proj, whose size all of them share */
+static iftImage *FirstProjection(const iftMIPProjections *proj)
+{
+    if (proj->max != NULL)
+        return proj->max;
+    if (proj->min != NULL)
+        return proj->min;
+
+    return (proj->mean != NULL) ? proj->mean : proj->depth;
+}
+
+void DestroyMIPProjections(iftMIPProjections **proj)
+{
+    if (*proj != NULL)
+    {
+        iftDestroyImage(&(*proj)->max);
+        iftDestroyImage(&(*proj)->min);
+        iftDestroyImage(&(*proj)->mean);
+        iftDestroyImage(&(*proj)->depth);
+        free(*proj);
+        *proj = NULL;
+    }
+}
+
+/* RenderTile() with every output of proj filled from a single walk of each ray */
+void ProjectTile(iftImage *img, const iftMIPVoxels *vox, const iftMIPBricks *bricks, iftMIPProjections *proj,
+                 const iftRaySetup *rs, int outputs, int u0, int v0, iftMIPScratch *s)
+{
+    iftImage *ref = FirstProjection(proj);
+    int u1 = iftMin(u0 + MIP_TILE_SIZE, rs->umax);
+    int v1 = iftMin(v0 + MIP_TILE_SIZE, rs->vmax);
+    int u, v, i, w, p;
+
+    u0 = iftMax(u0, rs->umin);
+    v0 = iftMax(v0, rs->vmin);
+
+    for (v = v0; v < v1; v++)
+        for (u = u0; u < u1; u += MIP_MAX_PACKET)
+        {
+            w = iftMin(MIP_MAX_PACKET, u1 - u);
+            ClipRayRow(rs, img, u, v, w, s);
+            s->count.rays += w;
+
+            for (i = 0; i < w; i++)
+            {
+                iftMIPReduce r = {.max = 0, .min = FLT_MAX, .sum = 0, .depth = 0, .count = 0};
+
+                if (s->hit[i])
+                {
+                    iftVector *e = &s->enter[i];
+                    iftVector *n = &s->dir[i];
+                    float depth0 = s->near[i] + (s->p1[i].x - e->x) * n->x + (s->p1[i].y - e->y) * n->y +
+                                   (s->p1[i].z - e->z) * n->z;
+
+                    s->count.hits++;
+                    ProjectRay(vox, bricks, s->p1[i], s->pn[i], depth0, *n, outputs, &s->count, &r);
+                }
+
+                p = u + i + ref->tby[v];
+                if (proj->max != NULL)
+                    proj->max->val[p] = ROUND(r.max);
+                if (proj->min != NULL)
+                    proj->min->val[p] = (r.min < FLT_MAX) ? ROUND(r.min) : 0;
+                if (proj->mean != NULL)
+                    proj->mean->val[p] = (r.count > 0) ? ROUND(r.sum / r.count) : 0;
+                if (proj->depth != NULL)
+                    proj->depth->val[p] = ROUND(r.depth);
+            }
+        }
+}
+
+/* MaximumIntensityProjectionThreads() generalized to the projections in outputs, a set of
+   iftMIPProjection, all filled by one traversal of the view. The DDA walk is used */
+iftMIPProjections *ProjectionThreads(iftImage *img, const iftMIPVoxels *vox, const iftMIPBricks *bricks,
+                                     float xtheta, float ytheta, int outputs, const iftMIPOptions *opt)
+{
+    iftMIPVoxels *linear = (vox == NULL) ? CreateMIPVoxels(img, 0, MIP_VOXEL_INT32) : NULL;
+    int ntu, ntiles, t, done = 0;
+    int nthreads = (opt->nthreads > 0) ? opt->nthreads : omp_get_max_threads();
+    iftMIPProjections *proj = (iftMIPProjections *) calloc(1, sizeof(iftMIPProjections));
+    iftMIPScratch *scratch;
+    iftRaySetup rs;
+
+    if ((outputs & MIP_PROJECT_ALL) == 0)
+        iftError("No projection asked for", "ProjectionThreads");
+
+    rs = FrameRaySetup(img, xtheta, ytheta, opt);
+    if (outputs & MIP_PROJECT_MAX)
+        proj->max = iftCreateImage(rs.xsize, rs.ysize, 1);
+    if (outputs & MIP_PROJECT_MIN)
+        proj->min = iftCreateImage(rs.xsize, rs.ysize, 1);
+    if (outputs & MIP_PROJECT_MEAN)
+        proj->mean = iftCreateImage(rs.xsize, rs.ysize, 1);
+    if (outputs & MIP_PROJECT_DEPTH)
+        proj->depth = iftCreateImage(rs.xsize, rs.ysize, 1);
+
+    scratch = CreateMIPScratch(nthreads, opt);
+    ntu = (rs.xsize + MIP_TILE_SIZE - 1) / MIP_TILE_SIZE;
+    ntiles = ntu * ((rs.ysize + MIP_TILE_SIZE - 1) / MIP_TILE_SIZE);
+
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(nthreads)
+    for (t = 0; t < ntiles; t++)
+    {
+        int u0 = (t % ntu) * MIP_TILE_SIZE, v0 = (t / ntu) * MIP_TILE_SIZE;
+
+        /* tiles that cannot see the volume stay black */
+        if (TileInFootprint(&rs, u0, v0))
+            ProjectTile(img, (vox != NULL) ? vox : linear, bricks, proj, &rs, outputs & MIP_PROJECT_ALL, u0, v0,
+                        &scratch[omp_get_thread_num()]);
+        ReportProgress(opt->verbose ? &done : NULL, ntiles);
+    }
+
+    if (opt->stats != NULL)
+        for (t = 0; t < nthreads; t++)
+            AddMIPCounters(opt->stats, &scratch[t].count);
+
+    free(scratch);
+    DestroyMIPVoxels(&linear);
+
+    return proj;
+}
+
+/* shear-warp: the volume is streamed in memory order and each slice along the principal
+   viewing axis is shifted by a whole number of voxels and max-composited into an
+   intermediate image aligned with that axis; a final 2D warp maps it to the view */
+iftImage *MaximumIntensityProjectionShearWarp(iftImage *img, float xtheta, float ytheta, const iftMIPOptions *opt)
+{
+    float diagonal, dir[3], si, sj;
+    int size[3], c, i, j, k, x, y, z, u, v;
+    int nthreads = opt->nthreads;
+    int minI = 0, maxI = 0, minJ = 0, maxJ = 0, Wi, Wj;
+    int *shiftI, *shiftJ, *inter;
+    iftRaySetup rs;
+
+    if (nthreads <= 0)
+        nthreads = omp_get_max_threads();
+
+    diagonal = VolumeDiagonal(img);
+    iftImage *output = iftCreateImage(diagonal, diagonal, 1);
+    rs = ViewRaySetup(img, xtheta, ytheta);
+
+    size[0] = img->xsize; size[1] = img->ysize; size[2] = img->zsize;
+    dir[0] = rs.dir.x; dir[1] = rs.dir.y; dir[2] = rs.dir.z;
+
+    /* principal axis c, intermediate image axes i < j */
+    c = 2;
+    if (fabs(dir[0]) >= fabs(dir[1]) && fabs(dir[0]) >= fabs(dir[2]))
+        c = 0;
+    else if (fabs(dir[1]) >= fabs(dir[2]))
+        c = 1;
+    i = (c == 0) ? 1 : 0;
+    j = (c == 2) ? 1 : 2;
+    si = dir[i] / dir[c];
+    sj = dir[j] / dir[c];
+
+    /* shear: slice k lands on the k = 0 plane shifted by -k * (si, sj) */
+    shiftI = iftAllocIntArray(size[c]);
+    shiftJ = iftAllocIntArray(size[c]);
+    for (k = 0; k < size[c]; k++)
+    {
+        shiftI[k] = ROUND(-k * si);
+        shiftJ[k] = ROUND(-k * sj);
+        minI = iftMin(minI, shiftI[k]); maxI = iftMax(maxI, shiftI[k]);
+        minJ = iftMin(minJ, shiftJ[k]); maxJ = iftMax(maxJ, shiftJ[k]);
+    }
+    for (k = 0; k < size[c]; k++)
+    {
+        shiftI[k] -= minI;
+        shiftJ[k] -= minJ;
+    }
+    Wi = size[i] + maxI - minI;
+    Wj = size[j] + maxJ - minJ;
+    inter = iftAllocIntArray(Wi * Wj);
+
+    for (z = 0; z < img->zsize; z++)
+    {
+        for (y = 0; y < img->ysize; y++)
+        {
+            const int *src = &img->val[img->tby[y] + img->tbz[z]];
+
+            if (c == 0)
+            {
+                for (x = 0; x < img->xsize; x++)
+                {
+                    int *dst = &inter[(y + shiftI[x]) + (z + shiftJ[x]) * Wi];
+                    if (src[x] > *dst)
+                        *dst = src[x];
+                }
+            }
+            else
+            {
+                /* the whole row shares one shift, so the max runs over contiguous memory */
+                k = (c == 1) ? y : z;
+                int *dst = &inter[shiftI[k] + (((c == 1) ? z : y) + shiftJ[k]) * Wi];
+                for (x = 0; x < img->xsize; x++)
+                    dst[x] = iftMax(dst[x], src[x]);
+            }
+        }
+    }
+
+    /* warp: follow each output ray back to the k = 0 plane of the intermediate image */
+    #pragma omp parallel for private(u) num_threads(nthreads)
+    for (v = 0; v < output->ysize; v++)
+    {
+        for (u = 0; u < output->xsize; u++)
+        {
+            iftVector o = RayOrigin(&rs, u, v);
+            float oc[3] = {o.x, o.y, o.z};
+            int I = ROUND(oc[i] - oc[c] * si) - minI;
+            int J = ROUND(oc[j] - oc[c] * sj) - minJ;
+
+            if (I >= 0 && I < Wi && J >= 0 && J < Wj)
+                output->val[u + output->tby[v]] = inter[I + J * Wi];
+        }
+    }
+
+    iftFree(shiftI);
+    iftFree(shiftJ);
+    iftFree(inter);
+
+    return output;
+}
+
+iftMIPOptions DefaultMIPOptions(void)
+{
+    iftMIPOptions opt;
+
+    opt.mode = MIP_RAYCAST;
+    opt.nthreads = 0;
+    opt.skip = 1;
+    opt.level = 0;
+    opt.verbose = 1;
+    opt.cache = 360;
+    opt.layout = MIP_LAYOUT_LINEAR;
+    opt.voxels = MIP_VOXEL_INT32;
+    opt.stats = NULL;
+    opt.adaptive = -1;
+    opt.traversal = MIP_TRAVERSAL_DDA;
+    opt.lmip = 0;
+    opt.threshold = 0;
+    opt.camera = NULL;
+
+    return opt;
+}
+
+/* a camera that sees img as the orthographic view 0 0 does, from one diagonal in front of its
+   centre, with a diagonal-sized image */
+iftMIPCamera DefaultMIPCamera(iftImage *img)
+{
+    iftMIPCamera cam;
+    float diagonal = VolumeDiagonal(img);
+
+    cam.at.x = img->xsize / 2.0;
+    cam.at.y = img->ysize / 2.0;
+    cam.at.z = img->zsize / 2.0;
+    cam.eye = cam.at;
+    cam.eye.z += diagonal;
+    cam.up.x = 0; cam.up.y = -1; cam.up.z = 0;
+    cam.fov = 45;
+    cam.near = 0;
+    cam.far = FLT_MAX;
+    cam.xsize = cam.ysize = diagonal;
+
+    return cam;
+}
+
+/* everything a view needs that does not depend on the angles, built once per volume */
+typedef struct mip_volume
+{
+    iftImage *img;             /* volume at the rendering level (not owned when level 0) */
+    iftMIPPyramid *pyr;
+    iftMIPVoxels *vox;         /* voxels as the ray kernels read them */
+    iftMIPBricks *bricks;
+    int volmax;
+    int ownsimg;               /* img is a voxel-less header made for a mapped volume */
+}iftMIPVolume;
+
+iftMIPVolume *CreateMIPVolume(iftImage *img, const iftMIPOptions *opt)
+{
+    double t0 = omp_get_wtime();
+    iftMIPVolume *vol = (iftMIPVolume *) calloc(1, sizeof(iftMIPVolume));
+
+    vol->img = img;
+    if (opt->level > 0)
+    {
+        vol->pyr = CreateMIPPyramid(img, opt->level + 1);
+        vol->img = vol->pyr->level[opt->level];
+    }
+
+    if (opt->mode == MIP_RAYCAST)
+        vol->vox = CreateMIPVoxels(vol->img, opt->layout == MIP_LAYOUT_BRICKED, opt->voxels);
+
+    if (opt->mode == MIP_RAYCAST && opt->skip)
+    {
+        vol->bricks = CreateMIPBricks(vol->vox);
+        vol->volmax = vol->bricks->volmax;
+    }
+    else
+        vol->volmax = iftMaximumValue(vol->img);
+
+    if (opt->stats != NULL)
+        AddMIPTime(&opt->stats->preprocess_ms, t0);
+
+    return vol;
+}
+
+/* a volume rendered straight from the pages of filename by the ray caster at level 0; vol->img
+   only carries the geometry. Building the bricks is the one full pass over the file */
+iftMIPVolume *CreateMappedMIPVolume(const char *filename, iftMIPMapHint hint, const iftMIPOptions *opt)
+{
+    float dxyz[3];
+    double t0 = omp_get_wtime();
+    iftMIPVolume *vol;
+
+    if (opt->mode != MIP_RAYCAST || opt->level > 0 || opt->layout != MIP_LAYOUT_LINEAR)
+        iftError("A mapped volume is only read in place by the ray caster, at level 0 and in the linear layout",
+                 "CreateMappedMIPVolume");
+
+    vol = (iftMIPVolume *) calloc(1, sizeof(iftMIPVolume));
+    vol->vox = MapMIPVoxels(filename, hint, dxyz);
+    if (opt->stats != NULL)
+        AddMIPTime(&opt->stats->load_ms, t0);
+    t0 = omp_get_wtime();
+
+    vol->img = iftCreateImage(vol->vox->size[0], vol->vox->size[1], vol->vox->size[2]);
+    iftFree(vol->img->val);
+    vol->img->val = NULL;
+    vol->img->dx = dxyz[0]; vol->img->dy = dxyz[1]; vol->img->dz = dxyz[2];
+    vol->ownsimg = 1;
+
+    vol->bricks = CreateMIPBricks(vol->vox);
+    vol->volmax = vol->bricks->volmax;
+    if (!opt->skip)
+        DestroyMIPBricks(&vol->bricks);
+
+    if (opt->stats != NULL)
+        AddMIPTime(&opt->stats->preprocess_ms, t0);
+
+    return vol;
+}
+
+void DestroyMIPVolume(iftMIPVolume **vol)
+{
+    if (*vol != NULL)
+    {
+        DestroyMIPBricks(&(*vol)->bricks);
+        DestroyMIPVoxels(&(*vol)->vox);
+        DestroyMIPPyramid(&(*vol)->pyr);
+        if ((*vol)->ownsimg)
+            iftDestroyImage(&(*vol)->img);
+        free(*vol);
+        *vol = NULL;
+    }
+}
+
+/* frees the int voxels of the rendered image once the ray caster reads from its own copy,
+   leaving vol->img with its geometry only. Returns 0 when the voxels are still needed */
+int ReleaseMIPVolumeSource(iftMIPVolume *vol)
+{
+    if (vol->vox == NULL || !vol->vox->owned)
+        return 0;
+
+    iftFree(vol->img->val);
+    vol->img->val = NULL;
+
+    return 1;
+}
+
+iftImage *RenderMIPView(const iftMIPVolume *vol, float xtheta, float ytheta, const iftMIPOptions *opt)
+{
+    double t0 = omp_get_wtime();
+    iftImage *output;
+
+    if (opt->mode == MIP_SHEARWARP && (opt->lmip || opt->camera != NULL))
+        iftError("The local MIP and the perspective camera need the ray caster", "RenderMIPView");
+    if (opt->mode == MIP_SHEARWARP)
+        output = MaximumIntensityProjectionShearWarp(vol->img, xtheta, ytheta, opt);
+    else
+        output = MaximumIntensityProjectionThreads(vol->img, vol->vox, vol->bricks, xtheta, ytheta,
+                                                   (opt->adaptive >= 0) ? (int) (opt->adaptive * vol->volmax) : -1,
+                                                   opt);
+
+    if (opt->stats != NULL)
+    {
+        AddMIPTime(&opt->stats->cast_ms, t0);
+        #pragma omp atomic
+        opt->stats->frames++;
+        #pragma omp atomic
+        opt->stats->count.pixels += output->n;
+    }
+
+    return output;
+}
+
+/* RenderMIPView() for the ray caster, handing each refinement pass to emit */
+iftImage *RenderMIPViewProgressive(const iftMIPVolume *vol, float xtheta, float ytheta, const iftMIPOptions *opt,
+                                   iftMIPProgressFunc emit, void *user)
+{
+    double t0 = omp_get_wtime();
+    iftImage *output;
+
+    if (opt->mode != MIP_RAYCAST)
+        iftError("Progressive rendering needs the ray caster", "RenderMIPViewProgressive");
+    output = MaximumIntensityProjectionProgressive(vol->img, vol->vox, vol->bricks, xtheta, ytheta, opt, emit, user);
+
+    if (opt->stats != NULL)
+    {
+        AddMIPTime(&opt->stats->cast_ms, t0);
+        #pragma omp atomic
+        opt->stats->frames++;
+        #pragma omp atomic
+        opt->stats->count.pixels += output->n;
+    }
+
+    return output;
+}
+
+/* the projections in outputs (a set of iftMIPProjection) of one view, from a single traversal */
+iftMIPProjections *ProjectMIPView(const iftMIPVolume *vol, float xtheta, float ytheta, int outputs,
+                                  const iftMIPOptions *opt)
+{
+    double t0 = omp_get_wtime();
+    iftMIPProjections *proj;
+
+    /* the MIP alone keeps the packet kernels and every rendering option */
+    if ((outputs & MIP_PROJECT_ALL) == MIP_PROJECT_MAX)
+    {
+        proj = (iftMIPProjections *) calloc(1, sizeof(iftMIPProjections));
+        proj->max = RenderMIPView(vol, xtheta, ytheta, opt);
+        return proj;
+    }
+
+    if (opt->mode != MIP_RAYCAST || opt->traversal != MIP_TRAVERSAL_DDA || opt->lmip)
+        iftError("Multiple projections need the ray caster with the DDA traversal and no local MIP",
+                 "ProjectMIPView");
+    proj = ProjectionThreads(vol->img, vol->vox, vol->bricks, xtheta, ytheta, outputs, opt);
+
+    if (opt->stats != NULL)
+    {
+        AddMIPTime(&opt->stats->cast_ms, t0);
+        #pragma omp atomic
+        opt->stats->frames++;
+        #pragma omp atomic
+        opt->stats->count.pixels += FirstProjection(proj)->n;
+    }
+
+    return proj;
+}
+
+iftImage *RenderMIP(iftImage *img, float xtheta, float ytheta, const iftMIPOptions *opt)
+{
+    iftImage *output;
+    iftMIPVolume *vol = CreateMIPVolume(img, opt);
+
+    output = RenderMIPView(vol, xtheta, ytheta, opt);
+    DestroyMIPVolume(&vol);
+
+    return output;
+}
+
+iftImage *MaximumIntensityProjection(iftImage *img, float xtheta, float ytheta)
+{
+    iftMIPOptions opt = DefaultMIPOptions();
+
+    return RenderMIP(img, xtheta, ytheta, &opt);
+}
+
+/* takes, from the samples DDA() would take along p1 -> pn, those with z in [z0, z1); slab holds
+   slices z0 .. z1 of the volume (z1 included while inside it, for the interpolation) */
+MIP_ALWAYS_INLINE float SlabWalk(const iftMIPVoxels *slab, int z0, int z1, int zsize, iftVoxel p1, iftVoxel pn,
+                                 float max, iftMIPVoxelType type)
+{
+    int n, k, kfirst, klast, ix, iy, iz, idx;
+    int xs = slab->step[1], xys = slab->step[2];
+    int xlast = slab->size[0] - 1, ylast = slab->size[1] - 1;
+    float x, y, z, t, J, ka, kb;
+    iftVector d;
+
+    n = DDASetup(p1, pn, &d);
+    kfirst = 0;
+    klast = n - 1;
+
+    /* a window of k around the slab, one sample wider on each side than the exact crossing */
+    if (d.z != 0)
+    {
+        ka = (z0 - p1.z) / d.z;
+        kb = (z1 - p1.z) / d.z;
+        if (iftMax(ka, kb) < -1 || iftMin(ka, kb) > n)
+            return max;
+        kfirst = iftMax(kfirst, (int) floorf(iftMax(iftMin(ka, kb), -1)) - 1);
+        klast = iftMin(klast, (int) ceilf(iftMin(iftMax(ka, kb), n)) + 1);
+    }
+    else if (p1.z < z0 || p1.z >= z1)
+        return max;
+
+    for (k = kfirst; k <= klast; k++)
+    {
+        t = (float) k;
+        x = p1.x + t * d.x;
+        y = p1.y + t * d.y;
+        z = p1.z + t * d.z;
+
+        if (z < z0 || z >= z1)
+            continue;
+        if (x < 0 || y < 0 || x > xlast || y > ylast || z > zsize - 1)
+            continue;
+
+        ix = (int) floorf(x); iy = (int) floorf(y); iz = (int) floorf(z);
+        idx = ix + iy * xs + (iz - z0) * xys;
+        J = SampleCell(slab->val, type, idx, (ix < xlast) ? 1 : 0, (iy < ylast) ? xs : 0,
+                       (iz < zsize - 1) ? xys : 0, x - ix, y - iy, z - iz);
+        if (J > max)
+            max = J;
+    }
+
+    return max;
+}
+
+float SlabDDA(const iftMIPVoxels *slab, int z0, int z1, int zsize, iftVoxel p1, iftVoxel pn, float max)
+{
+    switch (slab->type)
+    {
+        case MIP_VOXEL_UINT8:  return SlabWalk(slab, z0, z1, zsize, p1, pn, max, MIP_VOXEL_UINT8);
+        case MIP_VOXEL_UINT16: return SlabWalk(slab, z0, z1, zsize, p1, pn, max, MIP_VOXEL_UINT16);
+        case MIP_VOXEL_INT16:  return SlabWalk(slab, z0, z1, zsize, p1, pn, max, MIP_VOXEL_INT16);
+        default:               return SlabWalk(slab, z0, z1, zsize, p1, pn, max, MIP_VOXEL_INT32);
+    }
+}
+
+/* renders an uncompressed .scn, .nii or raw file that need not fit in memory: the file is read
+   in slabs of depth slices along z, and every ray is clipped to each slab in turn and
+   max-accumulated in a float image. Peak memory is one slab plus the output, and the result
+   is the image of the in-memory ray caster */
+iftImage *StreamingMIP(const char *filename, float xtheta, float ytheta, int depth, const iftMIPOptions *opt)
+{
+    iftImage geom, *output;
+    iftMIPVoxels *slab = (iftMIPVoxels *) calloc(1, sizeof(iftMIPVoxels));
+    iftRaySetup rs;
+    float dxyz[3], *acc;
+    long offset = ReadVolumeHeader(filename, slab, dxyz);
+    int zsize = slab->size[2], z0, Nu, Nv, p, nslabs, done = 0;
+    long hits = 0;
+    double t0;
+    int nthreads = (opt->nthreads > 0) ? opt->nthreads : omp_get_max_threads();
+    size_t slice = (size_t) slab->size[0] * slab->size[1] * VoxelTypeSize(slab->type);
+    FILE *fp;
+
+    if (depth <= 0)
+        iftError("The slab depth must be positive", "StreamingMIP");
+
+    /* the geometry helpers only look at the size of the image */
+    memset(&geom, 0, sizeof(geom));
+    geom.xsize = slab->size[0];
+    geom.ysize = slab->size[1];
+    geom.zsize = zsize;
+
+    Nu = Nv = VolumeDiagonal(&geom);
+    rs = ViewRaySetup(&geom, xtheta, ytheta);
+    acc = (float *) calloc((size_t) Nu * Nv, sizeof(float));
+
+    slab->step[0] = 1;
+    slab->step[1] = slab->size[0];
+    slab->step[2] = slab->size[0] * slab->size[1];
+    slab->val = malloc(slice * (depth + 1));
+    slab->owned = 1;
+
+    fp = fopen(filename, "rb");
+    if (fp == NULL || slab->val == NULL || acc == NULL)
+        iftError("Cannot stream %s", "StreamingMIP", filename);
+
+    nslabs = (zsize + depth - 1) / depth;
+    for (z0 = 0; z0 < zsize; z0 += depth)
+    {
+        int z1 = iftMin(z0 + depth, zsize), nread = iftMin(depth + 1, zsize - z0), v;
+
+        t0 = omp_get_wtime();
+        slab->size[2] = nread;
+        if (fseeko(fp, (off_t) offset + (off_t) z0 * slice, SEEK_SET) != 0 ||
+            fread(slab->val, slice, nread, fp) != (size_t) nread)
+            iftError("Cannot read slices %d to %d of %s", "StreamingMIP", z0, z0 + nread - 1, filename);
+#ifdef POSIX_FADV_WILLNEED
+        posix_fadvise(fileno(fp), (off_t) offset + (off_t) z1 * slice, (off_t) depth * slice, POSIX_FADV_WILLNEED);
+#endif
+        if (opt->stats != NULL)
+            AddMIPTime(&opt->stats->load_ms, t0);
+
+        t0 = omp_get_wtime();
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(nthreads) reduction(+:hits)
+        for (v = 0; v < Nv; v++)
+        {
+            int u;
+            iftVoxel p1, pn;
+
+            for (u = 0; u < Nu; u++)
+            {
+                if (!ComputeIntersection(RayOrigin(&rs, u, v), &geom, rs.dir, &p1, &pn))
+                    continue;
+                if (z0 == 0)
+                    hits++;
+                if (iftMax(p1.z, pn.z) >= z0 && iftMin(p1.z, pn.z) <= z1)
+                    acc[u + v * Nu] = SlabDDA(slab, z0, z1, zsize, p1, pn, acc[u + v * Nu]);
+            }
+        }
+        if (opt->stats != NULL)
+            AddMIPTime(&opt->stats->cast_ms, t0);
+        ReportProgress(opt->verbose ? &done : NULL, nslabs);
+    }
+    fclose(fp);
+
+    if (opt->stats != NULL)
+    {
+        opt->stats->count.rays += (long) Nu * Nv;
+        opt->stats->count.pixels += (long) Nu * Nv;
+        opt->stats->count.hits += hits;
+        opt->stats->frames++;
+    }
+
+    output = iftCreateImage(Nu, Nv, 1);
+    for (p = 0; p < output->n; p++)
+        output->val[p] = ROUND(acc[p]);
+
+    free(acc);
+    DestroyMIPVoxels(&slab);
+
+    return output;
+}
+
+/* views rendered in this session, keyed on their ray setup; a requested view whose direction
+   is the same as or opposite to a cached one, with image axes along the cached axes, is
+   resampled from it (a flip for antipodal views) instead of being cast again */
+typedef struct mip_view_entry
+{
+    iftRaySetup rs;
+    iftImage *img;
+}iftMIPViewEntry;
+
+typedef struct mip_view_cache
+{
+    int n, capacity;
+    int next;          /* oldest entry, replaced once the cache is full */
+    iftMIPViewEntry *entry;
+}iftMIPViewCache;
+
+iftMIPViewCache *CreateMIPViewCache(int capacity)
+{
+    iftMIPViewCache *cache = (iftMIPViewCache *) calloc(1, sizeof(iftMIPViewCache));
+
+    cache->capacity = capacity;
+    cache->entry = (iftMIPViewEntry *) calloc(capacity, sizeof(iftMIPViewEntry));
+
+    return cache;
+}
+
+void DestroyMIPViewCache(iftMIPViewCache **cache)
+{
+    int i;
+
+    if (*cache != NULL)
+    {
+        for (i = 0; i < (*cache)->n; i++)
+            iftDestroyImage(&(*cache)->entry[i].img);
+        free((*cache)->entry);
+        free(*cache);
+        *cache = NULL;
+    }
+}
+
+/* keeps a copy of the view */
+void AddToMIPViewCache(iftMIPViewCache *cache, const iftRaySetup *rs, const iftImage *img)
+{
+    iftMIPViewEntry *e;
+
+    if (cache->capacity <= 0)
+        return;
+
+    if (cache->n < cache->capacity)
+        e = &cache->entry[cache->n++];
+    else
+    {
+        e = &cache->entry[cache->next];
+        cache->next = (cache->next + 1) % cache->capacity;
+        iftDestroyImage(&e->img);
+    }
+
+    e->rs = *rs;
+    e->img = iftCreateImage(img->xsize, img->ysize, 1);
+    memcpy(e->img->val, img->val, sizeof(int) * img->n);
+}
+
+int IsAlignedUnit(iftVector a, iftVector b)
+{
+    return fabs(fabs(iftVectorInnerProduct(a, b)) - 1) < MIP_VIEW_EPSILON;
+}
+
+/* cached view whose rays are the lines of the requested one, or NULL */
+const iftMIPViewEntry *FindInMIPViewCache(const iftMIPViewCache *cache, const iftRaySetup *rs)
+{
+    int i;
+
+    for (i = 0; i < cache->n; i++)
+    {
+        const iftRaySetup *c = &cache->entry[i].rs;
+
+        if (IsAlignedUnit(rs->dir, c->dir) &&
+            (IsAlignedUnit(rs->du, c->du) || IsAlignedUnit(rs->du, c->dv)))
+            return &cache->entry[i];
+    }
+
+    return NULL;
+}
+
+/* casts the single ray of pixel (u,v); used for pixels a cached view does not cover */
+int CastRay(iftImage *img, const iftMIPVoxels *vox, const iftMIPBricks *bricks, const iftRaySetup *rs,
+            const iftMIPOptions *opt, int u, int v, iftMIPCounters *c)
+{
+    iftVector o = RayOrigin(rs, u, v), n = ZeroAlmostZero(rs->dir);
+    float t0, t1;
+
+    c->rays++;
+    if (!ClipRayToVolume(o, img, rs->dir, &t0, &t1))
+        return 0;
+
+    c->hits++;
+    if (opt->traversal == MIP_TRAVERSAL_EXACT)
+    {
+        iftVector enter = {.x = o.x + t0 * n.x, .y = o.y + t0 * n.y, .z = o.z + t0 * n.z};
+
+        return ExactDDA(vox, bricks, enter, n, t1 - t0, c);
+    }
+    if (opt->lmip)
+        return LMIPDDA(vox, bricks, BoxVoxel(o, n, t0, img), BoxVoxel(o, n, t1, img), opt->threshold, c);
+
+    return DDA(vox, bricks, BoxVoxel(o, n, t0, img), BoxVoxel(o, n, t1, img), c);
+}
+
+/* whether DDA() walks p1 -> pn exactly as it walked q1 -> qn, sample for sample. Walked the
+   other way, the samples are the same points only in exact arithmetic, unless the ray runs
+   along a volume axis, where they are the voxel centres in either direction */
+int SameDDAWalk(iftVoxel p1, iftVoxel pn, iftVoxel q1, iftVoxel qn)
+{
+    int along = (p1.x != pn.x) + (p1.y != pn.y) + (p1.z != pn.z);
+
+    if (p1.x == q1.x && p1.y == q1.y && p1.z == q1.z && pn.x == qn.x && pn.y == qn.y && pn.z == qn.z)
+        return 1;
+
+    return along <= 1 && p1.x == qn.x && p1.y == qn.y && p1.z == qn.z &&
+           pn.x == q1.x && pn.y == q1.y && pn.z == q1.z;
+}
+
+/* fills the requested view from a cached one: each output ray is located on the cached image
+   plane (du and dv are orthonormal), and its cached pixel is used when the ray falls on one
+   and would be walked exactly as that pixel's was, so the view is the same as when rendered
+   afresh. Other rays are cast */
+iftImage *ViewFromCacheEntry(const iftMIPVolume *vol, const iftMIPViewEntry *e, const iftRaySetup *rs,
+                             const iftMIPOptions *opt)
+{
+    int u, v, ncast = 0;
+    int nthreads = (opt->nthreads > 0) ? opt->nthreads : omp_get_max_threads();
+    double t0 = omp_get_wtime();
+    iftImage *output = iftCreateImage(e->img->xsize, e->img->ysize, 1);
+    iftMIPCounters *count = (iftMIPCounters *) calloc(nthreads, sizeof(iftMIPCounters));
+
+    #pragma omp parallel for private(u) reduction(+:ncast) num_threads(nthreads)
+    for (v = 0; v < output->ysize; v++)
+    {
+        for (u = 0; u < output->xsize; u++)
+        {
+            iftVector o = RayOrigin(rs, u, v);
+            iftVector rel = {.x = o.x - e->rs.base.x, .y = o.y - e->rs.base.y, .z = o.z - e->rs.base.z};
+            float fu = iftVectorInnerProduct(rel, e->rs.du), fv = iftVectorInnerProduct(rel, e->rs.dv);
+            int cu = ROUND(fu), cv = ROUND(fv), reuse = 0;
+
+            if (cu >= 0 && cu < e->img->xsize && cv >= 0 && cv < e->img->ysize &&
+                fabsf(fu - cu) < MIP_PIXEL_EPSILON && fabsf(fv - cv) < MIP_PIXEL_EPSILON)
+            {
+                iftVoxel p1, pn, q1, qn;
+                int hit = ComputeIntersection(o, vol->img, rs->dir, &p1, &pn);
+
+                if (ComputeIntersection(RayOrigin(&e->rs, cu, cv), vol->img, e->rs.dir, &q1, &qn))
+                    reuse = hit && SameDDAWalk(p1, pn, q1, qn);
+                else
+                    reuse = !hit;
+            }
+
+            if (reuse)
+                output->val[u + output->tby[v]] = e->img->val[cu + e->img->tby[cv]];
+            else
+            {
+                output->val[u + output->tby[v]] = CastRay(vol->img, vol->vox, vol->bricks, rs, opt, u, v,
+                                                          &count[omp_get_thread_num()]);
+                ncast++;
+            }
+        }
+    }
+
+
+    if (opt->stats != NULL)
+    {
+        for (u = 0; u < nthreads; u++)
+            AddMIPCounters(opt->stats, &count[u]);
+        AddMIPTime(&opt->stats->cast_ms, t0);
+        #pragma omp atomic
+        opt->stats->frames++;
+        #pragma omp atomic
+        opt->stats->count.pixels += output->n;
+    }
+    free(count);
+
+    if (opt->verbose)
+        printf("View reused from cache, %d rays cast\n", ncast);
+
+    return output;
+}
+
+/* renders a view through the cache; safe to call from several threads */
+iftImage *RenderMIPViewCached(const iftMIPVolume *vol, iftMIPViewCache *cache, float xtheta, float ytheta,
+                              const iftMIPOptions *opt)
+{
+    iftImage *output = NULL;
+    iftMIPViewEntry hit;
+    int found = 0;
+    iftRaySetup rs = ViewRaySetup(vol->img, xtheta, ytheta);
+
+    /* cached views are reused across orthographic views only, and flipping a view shot from the
+       opposite side only holds for the plain max: the local MIP depends on the ray direction.
+       A cached pixel stands for the DDA walk between two voxels, which neither the exact
+       traversal nor an interpolated adaptive pixel is, and the rays cast for uncovered pixels
+       need the ray caster's voxels, which shear-warp lacks */
+    if (opt->mode != MIP_RAYCAST || opt->camera != NULL || opt->lmip ||
+        opt->traversal != MIP_TRAVERSAL_DDA || opt->adaptive > 0)
+        return RenderMIPView(vol, xtheta, ytheta, opt);
+
+    #pragma omp critical (mip_view_cache)
+    {
+        const iftMIPViewEntry *e = FindInMIPViewCache(cache, &rs);
+
+        /* the entry may be recycled once the lock is released, so keep a private copy */
+        if (e != NULL)
+        {
+            hit.rs = e->rs;
+            hit.img = iftCreateImage(e->img->xsize, e->img->ysize, 1);
+            memcpy(hit.img->val, e->img->val, sizeof(int) * e->img->n);
+            found = 1;
+        }
+    }
+
+    if (found)
+    {
+        output = ViewFromCacheEntry(vol, &hit, &rs, opt);
+        iftDestroyImage(&hit.img);
+        return output;
+    }
+
+    output = RenderMIPView(vol, xtheta, ytheta, opt);
+
+    #pragma omp critical (mip_view_cache)
+    AddToMIPViewCache(cache, &rs, output);
+
+    return output;
+}
+
+/* maps [0, volmax] to [0, 255], the same for every frame so that a sweep does not flicker */
+void FrameToGray(const iftImage *frame, int volmax, uint8_t *gray)
+{
+    int p;
+
+    for (p = 0; p < frame->n; p++)
+        gray[p] = (volmax > 0) ? (uint8_t) iftMax(0, iftMin(255, (255L * frame->val[p]) / volmax)) : 0;
+}
+
+/* writes frame scaled as in FrameToGray(); stats may be NULL */
+void WriteGrayFrame(const iftImage *frame, int volmax, const char *path, iftMIPStats *stats)
+{
+    int p;
+    double t0 = omp_get_wtime();
+    uint8_t *gray = (uint8_t *) malloc(frame->n);
+    iftImage *normalized = iftCreateImage(frame->xsize, frame->ysize, frame->zsize);
+
+    FrameToGray(frame, volmax, gray);
+    for (p = 0; p < normalized->n; p++)
+        normalized->val[p] = gray[p];
+    if (stats != NULL)
+        AddMIPTime(&stats->normalize_ms, t0);
+
+    t0 = omp_get_wtime();
+    iftWriteImageByExt(normalized, path);
+    if (stats != NULL)
+        AddMIPTime(&stats->encode_ms, t0);
+
+    iftDestroyImage(&normalized);
+    free(gray);
+}
+
+/* renders nframes views of one volume, several frames at a time with one thread each, and
+   writes them to an animated GIF when output ends in .gif, or as PNGs into the output folder */
+void RenderMIPSweep(const iftMIPVolume *vol, const float *tilt, const float *spin, int nframes,
+                    const iftMIPOptions *opt, const char *output)
+{
+    int f, f0, batch, gif = iftEndsWith(output, ".gif");
+    int nthreads = (opt->nthreads > 0) ? opt->nthreads : omp_get_max_threads();
+    iftMIPOptions fopt = *opt;
+    iftImage **frames;
+    uint8_t **gray;
+    iftGifWriter writer;
+    iftMIPViewCache *cache = CreateMIPViewCache(opt->cache);
+
+    /* frames are the unit of parallelism, so each one is rendered serially and quietly */
+    fopt.nthreads = 1;
+    fopt.verbose = 0;
+
+    /* reject frame paths that would not fit, before any frame is rendered */
+    for (f = 0; !gif && f < nframes; f++)
+    {
+        char path[512];
+
+        if (snprintf(path, sizeof(path), "%s/%.1f%.1f.png", output, tilt[f], spin[f]) >= (int) sizeof(path))
+            iftError("Frame path in %s is too long", "RenderMIPSweep", output);
+    }
+
+    if (!gif && !iftDirExists(output))
+        iftMakeDir(output);
+
+    batch = nthreads;
+    frames = (iftImage **) calloc(batch, sizeof(iftImage *));
+    gray = (uint8_t **) calloc(batch, sizeof(uint8_t *));
+
+    for (f0 = 0; f0 < nframes; f0 += batch)
+    {
+        int n = iftMin(batch, nframes - f0);
+
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(nthreads)
+        for (f = 0; f < n; f++)
+        {
+            frames[f] = RenderMIPViewCached(vol, cache, tilt[f0 + f], spin[f0 + f], &fopt);
+            if (!gif)
+            {
+                char path[512];
+
+                snprintf(path, sizeof(path), "%s/%.1f%.1f.png", output, tilt[f0 + f], spin[f0 + f]);
+                WriteGrayFrame(frames[f], vol->volmax, path, opt->stats);
+            }
+        }
+
+        /* GIF frames must be appended in order */
+        for (f = 0; gif && f < n; f++)
+        {
+            int w = frames[f]->xsize, h = frames[f]->ysize;
+            double t0 = omp_get_wtime();
+            uint8_t *rgba = (uint8_t *) malloc(4 * (size_t) frames[f]->n);
+
+            gray[f] = (uint8_t *) malloc(frames[f]->n);
+            FrameToGray(frames[f], vol->volmax, gray[f]);
+            for (int p = 0; p < frames[f]->n; p++)
+            {
+                rgba[4 * p] = rgba[4 * p + 1] = rgba[4 * p + 2] = gray[f][p];
+                rgba[4 * p + 3] = 255;
+            }
+            if (opt->stats != NULL)
+                AddMIPTime(&opt->stats->normalize_ms, t0);
+
+            t0 = omp_get_wtime();
+            if (f0 + f == 0)
+                iftGifBegin(&writer, output, w, h, MIP_GIF_DELAY, 8, false);
+            iftGifWriteFrame(&writer, rgba, w, h, MIP_GIF_DELAY, 8, false);
+            if (opt->stats != NULL)
+                AddMIPTime(&opt->stats->encode_ms, t0);
+            free(rgba);
+            free(gray[f]);
+        }
+
+        for (f = 0; f < n; f++)
+            iftDestroyImage(&frames[f]);
+
+        if (opt->verbose)
+        {
+            printf("Frames : %d/%d\n", f0 + n, nframes);
+            fflush(stdout);
+        }
+    }
+
+    if (gif && nframes > 0)
+        iftGifEnd(&writer);
+
+    free(frames);
+    free(gray);
+    DestroyMIPViewCache(&cache);
+}
+
+/* thin-slab MIP cine: voxel (x,y,z) of the result is the max over the slabsize voxels along
+   axis centred on it, so slice k across that axis is the slab MIP at position k. Every column
+   along the axis keeps a monotonic deque of its window, which makes the cost O(voxels)
+   whatever the slab thickness; the volume is read once, in memory order */
+iftImage *SlidingSlabMIP(iftImage *img, char axis, int slabsize, int nthreads)
+{
+    int nouter, len, ninner, ostride, astride, nchunks, item;
+    int before = (slabsize - 1) / 2, after = slabsize - 1 - before;
+    int cap = slabsize + 1;
+    iftImage *out = iftCreateImage(img->xsize, img->ysize, img->zsize);
+
+    if (nthreads <= 0)
+        nthreads = omp_get_max_threads();
+
+    /* the volume as [outer][axis][inner], inner being contiguous */
+    if (axis == IFT_AXIS_Z)
+    {
+        nouter = 1;           ostride = 0;
+        len = img->zsize;     astride = img->xsize * img->ysize;
+        ninner = astride;
+    }
+    else if (axis == IFT_AXIS_Y)
+    {
+        nouter = img->zsize;  ostride = img->xsize * img->ysize;
+        len = img->ysize;     astride = img->xsize;
+        ninner = img->xsize;
+    }
+    else
+    {
+        nouter = img->zsize * img->ysize; ostride = img->xsize;
+        len = img->xsize;     astride = 1;
+        ninner = 1;
+    }
+    nchunks = (ninner + MIP_SLAB_CHUNK - 1) / MIP_SLAB_CHUNK;
+
+    #pragma omp parallel num_threads(nthreads)
+    {
+        int *qidx = iftAllocIntArray((size_t) MIP_SLAB_CHUNK * cap);
+        int *qval = iftAllocIntArray((size_t) MIP_SLAB_CHUNK * cap);
+        int *head = iftAllocIntArray(MIP_SLAB_CHUNK);
+        int *size = iftAllocIntArray(MIP_SLAB_CHUNK);
+
+        #pragma omp for schedule(dynamic, 1)
+        for (item = 0; item < nouter * nchunks; item++)
+        {
+            int o = item / nchunks;
+            int i0 = (item % nchunks) * MIP_SLAB_CHUNK, i1 = iftMin(i0 + MIP_SLAB_CHUNK, ninner);
+            const int *src = &img->val[o * ostride];
+            int *dst = &out->val[o * ostride];
+            int a, i, k;
+
+            for (i = 0; i < i1 - i0; i++)
+                head[i] = size[i] = 0;
+
+            for (a = 0; a < len; a++)
+            {
+                for (i = i0; i < i1; i++)
+                {
+                    int c = i - i0, v = src[a * astride + i];
+                    int *qi = &qidx[c * cap], *qv = &qval[c * cap];
+
+                    /* drop the tail values the new one dominates, then append it */
+                    while (size[c] > 0 && qv[(head[c] + size[c] - 1) % cap] <= v)
+                        size[c]--;
+                    qi[(head[c] + size[c]) % cap] = a;
+                    qv[(head[c] + size[c]) % cap] = v;
+                    size[c]++;
+
+                    k = a - after;
+                    if (k >= 0)
+                    {
+                        while (qi[head[c]] < k - before)
+                        {
+                            head[c] = (head[c] + 1) % cap;
+                            size[c]--;
+                        }
+                        dst[k * astride + i] = qv[head[c]];
+                    }
+                }
+            }
+
+            /* the last windows are cut short by the end of the volume */
+            for (k = iftMax(0, len - after); k < len; k++)
+            {
+                for (i = i0; i < i1; i++)
+                {
+                    int c = i - i0;
+                    int *qi = &qidx[c * cap], *qv = &qval[c * cap];
+
+                    while (qi[head[c]] < k - before)
+                    {
+                        head[c] = (head[c] + 1) % cap;
+                        size[c]--;
+                    }
+                    dst[k * astride + i] = qv[head[c]];
+                }
+            }
+        }
+
+        iftFree(qidx);
+        iftFree(qval);
+        iftFree(head);
+        iftFree(size);
+    }
+
+    return out;
+}
+
+/* writes the slab MIP volume as is when output is a volume file, or one PNG per slice across
+   the axis into the output folder otherwise */
+void WriteSlabMIP(iftImage *slab, char axis, const char *output)
+{
+    int k, n, volmax;
+    char path[512];
+
+    if (iftEndsWith(output, ".scn") || iftEndsWith(output, ".nii") || iftEndsWith(output, ".nii.gz"))
+    {
+        iftWriteImageByExt(slab, output);
+        return;
+    }
+
+    n = (axis == IFT_AXIS_Z) ? slab->zsize : (axis == IFT_AXIS_Y) ? slab->ysize : slab->xsize;
+    /* the last slice has the longest path */
+    if (snprintf(path, sizeof(path), "%s/%04d.png", output, n - 1) >= (int) sizeof(path))
+        iftError("Slice path in %s is too long", "WriteSlabMIP", output);
+
+    if (!iftDirExists(output))
+        iftMakeDir(output);
+
+    volmax = iftMaximumValue(slab);
+    for (k = 0; k < n; k++)
+    {
+        iftImage *slice = (axis == IFT_AXIS_Z) ? iftGetXYSlice(slab, k) :
+                          (axis == IFT_AXIS_Y) ? iftGetZXSlice(slab, k) : iftGetYZSlice(slab, k);
+
+        snprintf(path, sizeof(path), "%s/%04d.png", output, k);
+        WriteGrayFrame(slice, volmax, path, NULL);
+        iftDestroyImage(&slice);
+    }
+}
+
+iftMIPVoxelType ParseVoxelType(const char *name)
+{
+    if (strcmp(name, "auto") == 0)
+        return MIP_VOXEL_AUTO;
+    if (strcmp(name, "uint8") == 0)
+        return MIP_VOXEL_UINT8;
+    if (strcmp(name, "uint16") == 0)
+        return MIP_VOXEL_UINT16;
+    if (strcmp(name, "int16") == 0)
+        return MIP_VOXEL_INT16;
+    if (strcmp(name, "int32") != 0)
+        iftError("Unknown voxel type %s", "ParseVoxelType", name);
+
+    return MIP_VOXEL_INT32;
+}
+
+/* writes the statistics of a render as JSON; counters are doubles, as they outgrow an int */
+void WriteMIPStats(const iftMIPStats *stats, const char *path)
+{
+    iftJson *json = iftCreateJsonRoot();
+
+    iftAddIntToJson(json, "frames", stats->frames);
+    iftAddJDictReferenceToJson(json, "counters", iftCreateJDict());
+    iftAddDoubleToJson(json, "counters:rays", stats->count.rays);
+    iftAddDoubleToJson(json, "counters:hits", stats->count.hits);
+    iftAddDoubleToJson(json, "counters:samples", stats->count.samples);
+    iftAddDoubleToJson(json, "counters:bricks_skipped", stats->count.skipped);
+    iftAddDoubleToJson(json, "counters:early_terminations", stats->count.early);
+    iftAddDoubleToJson(json, "counters:pixels", stats->count.pixels);
+    iftAddDoubleToJson(json, "counters:ray_fraction",
+                       (stats->count.pixels > 0) ? (double) stats->count.rays / stats->count.pixels : 0);
+    iftAddDoubleToJson(json, "counters:traversed_fraction",
+                       (stats->count.length > 0) ? (double) stats->count.walked / stats->count.length : 1);
+    iftAddJDictReferenceToJson(json, "ms", iftCreateJDict());
+    iftAddDoubleToJson(json, "ms:load", stats->load_ms);
+    iftAddDoubleToJson(json, "ms:preprocess", stats->preprocess_ms);
+    iftAddDoubleToJson(json, "ms:cast", stats->cast_ms);
+    iftAddDoubleToJson(json, "ms:normalize", stats->normalize_ms);
+    iftAddDoubleToJson(json, "ms:encode", stats->encode_ms);
+
+    iftWriteJson(json, path);
+    iftDestroyJson(&json);
+}
+
+/* writes view stretched to [0, 255] as path */
+void WriteNormalizedView(iftImage *view, const char *path, iftMIPStats *stats)
+{
+    double t0 = omp_get_wtime();
+    iftImage *normalizedImage = iftNormalize(view, 0, 255);
+
+    if (stats != NULL)
+        AddMIPTime(&stats->normalize_ms, t0);
+
+    t0 = omp_get_wtime();
+    iftWriteImageByExt(normalizedImage, path);
+    if (stats != NULL)
+        AddMIPTime(&stats->encode_ms, t0);
+    iftDestroyImage(&normalizedImage);
+}
+
+/* writes a single view, normalized to 0..255, as data/<tilt><spin><name>; stats may be NULL */
+void WriteMIPView(iftImage *output, float xtheta, float ytheta, const char *name, iftMIPStats *stats)
+{
+    char path[512];
+
+    if (snprintf(path, sizeof(path), "data/%.1f%.1f%s", xtheta, ytheta, name) >= (int) sizeof(path))
+        iftError("Output name %s is too long", "WriteMIPView", name);
+    WriteNormalizedView(output, path, stats);
+    iftDestroyImage(&output);
+}
+
+/* where WriteProgressivePass() writes the passes of a progressive render */
+typedef struct mip_pass_writer
+{
+    const char *name;
+    float xtheta, ytheta;
+    int volmax;
+    iftMIPStats *stats;
+}iftMIPPassWriter;
+
+/* an iftMIPProgressFunc writing every pass but the last, which is the view itself, as
+   data/<tilt><spin>pass<k><name>, scaled as in FrameToGray() */
+void WriteProgressivePass(const iftImage *view, int pass, int npasses, void *user)
+{
+    const iftMIPPassWriter *w = (const iftMIPPassWriter *) user;
+    char path[512];
+
+    if (pass == npasses)
+        return;
+    snprintf(path, sizeof(path), "data/%.1f%.1fpass%d%s", w->xtheta, w->ytheta, pass, w->name);
+    WriteGrayFrame(view, w->volmax, path, w->stats);
+}
+
+/* a comma-separated list of max, min, mean and depth, as a set of iftMIPProjection */
+int ParseProjections(const char *list)
+{
+    const char *names[] = {"max", "min", "mean", "depth"};
+    int i, outputs = 0;
+    char *copy = iftCopyString(list), *name;
+
+    for (name = strtok(copy, ","); name != NULL; name = strtok(NULL, ","))
+    {
+        for (i = 0; i < 4 && strcmp(name, names[i]) != 0; i++)
+            ;
+        if (i == 4)
+            iftError("Unknown projection %s", "ParseProjections", name);
+        outputs |= 1 << i;
+    }
+    iftFree(copy);
+
+    return outputs;
+}
+
+/* writes each projection as WriteMIPView() does, the name prefixed with its kind */
+void WriteMIPProjections(iftMIPProjections *proj, float xtheta, float ytheta, const char *name, iftMIPStats *stats)
+{
+    iftImage **img[] = {&proj->max, &proj->min, &proj->mean, &proj->depth};
+    const char *kind[] = {"max", "min", "mean", "depth"};
+    char buffer[512];
+    int i;
+
+    for (i = 0; i < 4; i++)
+        if (*img[i] != NULL)
+        {
+            if (snprintf(buffer, sizeof(buffer), "%s_%s", kind[i], name) >= (int) sizeof(buffer))
+                iftError("Output name %s is too long", "WriteMIPProjections", name);
+            WriteMIPView(*img[i], xtheta, ytheta, buffer, stats);
+            *img[i] = NULL;
+        }
+}
+
+/* "x,y,z" */
+iftVector ParseVector(const char *text)
+{
+    iftVector v;
+
+    if (sscanf(text, "%f,%f,%f", &v.x, &v.y, &v.z) != 3)
+        iftError("Invalid vector %s, expected x,y,z", "ParseVector", text);
+
+    return v;
+}
+
+iftMIPTraversal ParseTraversal(const char *name)
+{
+    if (strcmp(name, "exact") == 0)
+        return MIP_TRAVERSAL_EXACT;
+    if (strcmp(name, "dda") != 0)
+        iftError("Unknown traversal %s", "ParseTraversal", name);
+
+    return MIP_TRAVERSAL_DDA;
+}
+
+iftMIPMapHint ParseMapHint(const char *name)
+{
+    if (strcmp(name, "populate") == 0)
+        return MIP_MAP_POPULATE;
+    if (strcmp(name, "willneed") == 0)
+        return MIP_MAP_WILLNEED;
+    if (strcmp(name, "random") == 0)
+        return MIP_MAP_RANDOM;
+    if (strcmp(name, "lazy") != 0)
+        iftError("Unknown mmap hint %s", "ParseMapHint", name);
+
+    return MIP_MAP_LAZY;
+}
+
+/* reads one "tilt spin" pair per line */
+int ReadSweepAngles(const char *filename, float **tilt, float **spin)
+{
+    int n = 0, cap = 64;
+    float t, s;
+    FILE *fp = fopen(filename, "r");
+
+    if (fp == NULL)
+        iftError("Cannot open angle list %s", "ReadSweepAngles", filename);
+
+    *tilt = (float *) malloc(cap * sizeof(float));
+    *spin = (float *) malloc(cap * sizeof(float));
+    while (fscanf(fp, "%f %f", &t, &s) == 2)
+    {
+        if (n == cap)
+        {
+            cap *= 2;
+            *tilt = (float *) realloc(*tilt, cap * sizeof(float));
+            *spin = (float *) realloc(*spin, cap * sizeof(float));
+        }
+        (*tilt)[n] = t;
+        (*spin)[n] = s;
+        n++;
+    }
+    fclose(fp);
+
+    return n;
+}
+
+
+/* checks, without decoding the voxels, that path is an .scn, .zscn, .nii or .nii.gz volume
+   whose header is valid and whose voxels are all there, since iftReadImageByExt() ends the
+   process on a bad file. Compressed files are checked against the uncompressed size in their
+   gzip trailer. Returns 0 with the reason otherwise */
+int CheckVolumeFile(const char *path, char *reason, size_t size)
+{
+    int scn = iftEndsWith(path, ".scn") || iftEndsWith(path, ".zscn");
+    int nii = iftEndsWith(path, ".nii") || iftEndsWith(path, ".nii.gz");
+    unsigned char hdr[352], tail[4];
+    long need, length;
+    int got, gz = 0;
+    struct stat st;
+    gzFile gf;
+    FILE *fp;
+
+    if (!scn && !nii)
+    {
+        snprintf(reason, size, "%s is not an .scn, .zscn, .nii or .nii.gz volume", path);
+        return 0;
+    }
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode) || (fp = fopen(path, "rb")) == NULL)
+    {
+        snprintf(reason, size, "cannot read %s", path);
+        return 0;
+    }
+    gz = (fread(tail, 1, 2, fp) == 2 && tail[0] == 0x1f && tail[1] == 0x8b);
+    length = st.st_size;
+    if (gz && (st.st_size < 18 || fseek(fp, -4, SEEK_END) != 0 || fread(tail, 1, 4, fp) != 4))
+        gz = -1;
+    fclose(fp);
+
+    /* gzread() reads uncompressed files as they are */
+    got = -1;
+    if (gz >= 0 && (gf = gzopen(path, "rb")) != NULL)
+    {
+        got = gzread(gf, hdr, sizeof(hdr));
+        gzclose(gf);
+    }
+    if (got <= 0)
+    {
+        snprintf(reason, size, "%s is empty or truncated", path);
+        return 0;
+    }
+
+    if (scn)
+    {
+        char text[sizeof(hdr) + 1], magic[4] = "";
+        int xsize, ysize, zsize, bits, len = 0;
+        float dx, dy, dz;
+
+        memcpy(text, hdr, got);
+        text[got] = '\0';
+        if (sscanf(text, "%3s %d %d %d %f %f %f %d%n", magic, &xsize, &ysize, &zsize, &dx, &dy, &dz, &bits,
+                   &len) != 8 || strcmp(magic, "SCN") != 0 || xsize <= 0 || ysize <= 0 || zsize <= 0 ||
+            (bits != 8 && bits != 16 && bits != 32))
+        {
+            snprintf(reason, size, "invalid SCN header in %s", path);
+            return 0;
+        }
+        need = len + 1 + (long) xsize * ysize * zsize * (bits / 8);
+    }
+    else
+    {
+        short dim[8], bitpix;
+        float voxoffset;
+        int sizeofhdr, i, swap;
+
+        if (got < 348)
+        {
+            snprintf(reason, size, "invalid NIfTI header in %s", path);
+            return 0;
+        }
+        memcpy(&sizeofhdr, hdr, sizeof(int));
+        memcpy(dim, hdr + 40, sizeof(dim));
+        memcpy(&bitpix, hdr + 72, sizeof(short));
+        memcpy(&voxoffset, hdr + 108, sizeof(float));
+
+        swap = (sizeofhdr != 348);
+        if (swap)
+        {
+            uint32_t v;
+
+            for (i = 0; i < 8; i++)
+                dim[i] = (short) __builtin_bswap16((uint16_t) dim[i]);
+            bitpix = (short) __builtin_bswap16((uint16_t) bitpix);
+            memcpy(&v, &voxoffset, sizeof(v));
+            v = __builtin_bswap32(v);
+            memcpy(&voxoffset, &v, sizeof(v));
+        }
+        if ((swap && __builtin_bswap32((uint32_t) sizeofhdr) != 348) || memcmp(hdr + 344, "n+1", 4) != 0 ||
+            dim[0] < 1 || dim[0] > 7 || bitpix <= 0 || bitpix % 8 != 0 || voxoffset < 348)
+        {
+            snprintf(reason, size, "%s is not a valid single-file NIfTI-1 volume", path);
+            return 0;
+        }
+        need = bitpix / 8;
+        for (i = 1; i <= dim[0]; i++)
+        {
+            if (dim[i] <= 0)
+            {
+                snprintf(reason, size, "invalid NIfTI dimensions in %s", path);
+                return 0;
+            }
+            need *= dim[i];
+        }
+        need += (long) voxoffset;
+    }
+
+    /* the trailer holds the uncompressed size modulo 2^32 */
+    if (gz)
+        length = (gz < 0) ? -1 : (long) ((uint32_t) tail[0] | (uint32_t) tail[1] << 8 |
+                                         (uint32_t) tail[2] << 16 | (uint32_t) tail[3] << 24);
+    if (gz ? (length != (need & 0xffffffffL)) : (length < need))
+    {
+        snprintf(reason, size, "%s is truncated", path);
+        return 0;
+    }
+
+    return 1;
+}
+
+/* a volume kept by the render server between requests; the ray caster and shear-warp state of
+   each pyramid level is built on its first request */
+typedef struct mip_served_volume
+{
+    char *path;
+    iftImage *img;
+    iftMIPPyramid *pyr;
+    iftMIPVolume *vol[2][MIP_SERVE_LEVELS];   /* [mode][level] */
+    long lastuse;
+}iftMIPServedVolume;
+
+typedef struct mip_server
+{
+    iftMIPServedVolume *slot;
+    int capacity;              /* volumes kept loaded; the least recently used one is dropped */
+    long clock;
+    iftMIPOptions opt;
+}iftMIPServer;
+
+iftMIPServer *CreateMIPServer(int capacity, const iftMIPOptions *opt)
+{
+    iftMIPServer *srv = (iftMIPServer *) calloc(1, sizeof(iftMIPServer));
+
+    srv->capacity = iftMax(1, capacity);
+    srv->slot = (iftMIPServedVolume *) calloc(srv->capacity, sizeof(iftMIPServedVolume));
+    srv->opt = *opt;
+    srv->opt.level = 0;
+    srv->opt.verbose = 0;      /* the reply stream may be stdout */
+    srv->opt.stats = NULL;
+
+    return srv;
+}
+
+void UnloadServedVolume(iftMIPServedVolume *sv)
+{
+    int m, l;
+
+    for (m = 0; m < 2; m++)
+        for (l = 0; l < MIP_SERVE_LEVELS; l++)
+            DestroyMIPVolume(&sv->vol[m][l]);
+    DestroyMIPPyramid(&sv->pyr);
+    iftDestroyImage(&sv->img);
+    free(sv->path);
+    memset(sv, 0, sizeof(iftMIPServedVolume));
+}
+
+void DestroyMIPServer(iftMIPServer **srv)
+{
+    int i;
+
+    if (*srv != NULL)
+    {
+        for (i = 0; i < (*srv)->capacity; i++)
+            UnloadServedVolume(&(*srv)->slot[i]);
+        free((*srv)->slot);
+        free(*srv);
+        *srv = NULL;
+    }
+}
+
+iftMIPServedVolume *FindServedVolume(iftMIPServer *srv, const char *path)
+{
+    int i;
+
+    for (i = 0; i < srv->capacity; i++)
+        if (srv->slot[i].path != NULL && strcmp(srv->slot[i].path, path) == 0)
+            return &srv->slot[i];
+
+    return NULL;
+}
+
+/* returns the loaded volume, reading it into a free or the least recently used slot first.
+   NULL, with the reason, when the file does not pass CheckVolumeFile(), which is reported to the
+   client instead of ending the server */
+iftMIPServedVolume *LoadServedVolume(iftMIPServer *srv, const char *path, char *reason, size_t size)
+{
+    iftMIPServedVolume *sv = FindServedVolume(srv, path);
+    iftImage *img;
+    int i, nlevels, minval, maxval;
+
+    if (sv == NULL)
+    {
+        if (!CheckVolumeFile(path, reason, size))
+            return NULL;
+
+        /* CreateMIPVoxels() ends the process on values the -voxels type cannot hold */
+        img = iftReadImageByExt(path);
+        minval = iftMinimumValue(img);
+        maxval = iftMaximumValue(img);
+        if (!VoxelTypeHolds(srv->opt.voxels, minval, maxval))
+        {
+            snprintf(reason, size, "voxel values of %s in [%d, %d] do not fit the -voxels type", path, minval, maxval);
+            iftDestroyImage(&img);
+            return NULL;
+        }
+
+        sv = &srv->slot[0];
+        for (i = 1; i < srv->capacity && sv->path != NULL; i++)
+            if (srv->slot[i].path == NULL || srv->slot[i].lastuse < sv->lastuse)
+                sv = &srv->slot[i];
+        UnloadServedVolume(sv);
+
+        sv->path = iftCopyString(path);
+        sv->img = img;
+        for (nlevels = 1; nlevels < MIP_SERVE_LEVELS; nlevels++)
+            if (iftMin(sv->img->xsize, iftMin(sv->img->ysize, sv->img->zsize)) >> nlevels < MIP_BRICK_SIZE)
+                break;
+        sv->pyr = CreateMIPPyramid(sv->img, nlevels);
+    }
+    sv->lastuse = ++srv->clock;
+
+    return sv;
+}
+
+/* the coarsest level whose view is still at least size pixels wide; size <= 0 asks for level 0 */
+int ServedLevel(const iftMIPServedVolume *sv, int size)
+{
+    int l = 0;
+
+    while (size > 0 && l + 1 < sv->pyr->nlevels && VolumeDiagonal(sv->pyr->level[l + 1]) >= size)
+        l++;
+
+    return l;
+}
+
+/* nearest-pixel resampling of a view to size x size */
+iftImage *ResizeMIPView(const iftImage *view, int size)
+{
+    int u, v;
+    iftImage *out = iftCreateImage(size, size, 1);
+
+    for (v = 0; v < size; v++)
+        for (u = 0; u < size; u++)
+            out->val[u + out->tby[v]] = view->val[(u * view->xsize) / size + view->tby[(v * view->ysize) / size]];
+
+    return out;
+}
+
+/* renders one request and writes "OK <nbytes>" followed by the view as a binary 8-bit PGM,
+   normalized to the maximum of the rendered level */
+void ServeMIPRender(iftMIPServer *srv, iftMIPServedVolume *sv, float xtheta, float ytheta, int size,
+                    iftMIPMode mode, FILE *out)
+{
+    iftMIPOptions opt = srv->opt;
+    int l = ServedLevel(sv, size);
+    iftImage *view;
+    uint8_t *gray;
+    char header[64];
+    int len;
+
+    opt.mode = mode;
+    if (sv->vol[mode][l] == NULL)
+        sv->vol[mode][l] = CreateMIPVolume(sv->pyr->level[l], &opt);
+
+    view = RenderMIPView(sv->vol[mode][l], xtheta, ytheta, &opt);
+    if (size > 0 && (view->xsize != size || view->ysize != size))
+    {
+        iftImage *resized = ResizeMIPView(view, size);
+
+        iftDestroyImage(&view);
+        view = resized;
+    }
+
+    gray = (uint8_t *) malloc(view->n);
+    FrameToGray(view, sv->vol[mode][l]->volmax, gray);
+    len = sprintf(header, "P5\n%d %d\n255\n", view->xsize, view->ysize);
+    fprintf(out, "OK %d\n%s", len + view->n, header);
+    fwrite(gray, 1, view->n, out);
+    fflush(out);
+
+    free(gray);
+    iftDestroyImage(&view);
+}
+
+/* answers requests, one per line, until the input ends (returns 0) or "quit" (returns 1):
+     render <volume> <tilt> <spin> [size [raycast|shearwarp]]
+     load <volume>
+     unload <volume>
+   every request gets a reply line, "OK ..." or "ERR <reason>" */
+int ServeMIPRequests(iftMIPServer *srv, FILE *in, FILE *out)
+{
+    char line[1024], cmd[16], path[1024], mode[16], reason[1200];
+    float xtheta, ytheta;
+    int n, size;
+    iftMIPServedVolume *sv;
+
+    while (fgets(line, sizeof(line), in) != NULL)
+    {
+        size = 0;
+        strcpy(mode, (srv->opt.mode == MIP_SHEARWARP) ? "shearwarp" : "raycast");
+        n = sscanf(line, "%15s %1023s %f %f %d %15s", cmd, path, &xtheta, &ytheta, &size, mode);
+        if (n < 1)
+            continue;
+
+        if (strcmp(cmd, "quit") == 0)
+        {
+            fprintf(out, "OK\n");
+            fflush(out);
+            return 1;
+        }
+        if (n < 2 || (strcmp(cmd, "render") == 0 && n < 4))
+            fprintf(out, "ERR missing arguments to %s\n", cmd);
+        else if (strcmp(cmd, "unload") == 0)
+        {
+            if ((sv = FindServedVolume(srv, path)) != NULL)
+                UnloadServedVolume(sv);
+            fprintf(out, "OK\n");
+        }
+        else if (strcmp(cmd, "load") != 0 && strcmp(cmd, "render") != 0)
+            fprintf(out, "ERR unknown request %s\n", cmd);
+        else if (strcmp(mode, "raycast") != 0 && strcmp(mode, "shearwarp") != 0)
+            fprintf(out, "ERR unknown mode %s\n", mode);
+        else if (strcmp(mode, "shearwarp") == 0 && (srv->opt.lmip || srv->opt.camera != NULL))
+            fprintf(out, "ERR shearwarp renders neither the local MIP nor a perspective camera\n");
+        else if ((sv = LoadServedVolume(srv, path, reason, sizeof(reason))) == NULL)
+            fprintf(out, "ERR %s\n", reason);
+        else if (strcmp(cmd, "load") == 0)
+            fprintf(out, "OK %d %d %d\n", sv->img->xsize, sv->img->ysize, sv->img->zsize);
+        else
+            ServeMIPRender(srv, sv, xtheta, ytheta, size,
+                           (strcmp(mode, "shearwarp") == 0) ? MIP_SHEARWARP : MIP_RAYCAST, out);
+        fflush(out);
+    }
+
+    return 0;
+}
+
+/* keeps up to capacity volumes loaded and serves requests from stdin/stdout (endpoint "-") or
+   from the clients of a Unix domain socket at endpoint, one connection at a time, until "quit" */
+void ServeMIP(const char *endpoint, int capacity, const iftMIPOptions *opt)
+{
+    iftMIPServer *srv = CreateMIPServer(capacity, opt);
+    struct sockaddr_un addr;
+    int fd, conn, quit = 0;
+
+    if (strcmp(endpoint, "-") == 0)
+    {
+        ServeMIPRequests(srv, stdin, stdout);
+        DestroyMIPServer(&srv);
+        return;
+    }
+
+    if (strlen(endpoint) >= sizeof(addr.sun_path))
+        iftError("Socket path %s is too long", "ServeMIP", endpoint);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, endpoint);
+
+    /* a client that hangs up mid-reply must not end the server */
+    signal(SIGPIPE, SIG_IGN);
+    unlink(endpoint);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+        listen(fd, 8) != 0)
+        iftError("Cannot listen on %s", "ServeMIP", endpoint);
+
+    while (!quit && (conn = accept(fd, NULL, NULL)) >= 0)
+    {
+        FILE *in = fdopen(conn, "r");
+        FILE *out = fdopen(dup(conn), "w");
+
+        quit = ServeMIPRequests(srv, in, out);
+        fclose(in);
+        fclose(out);
+    }
+
+    close(fd);
+    unlink(endpoint);
+    DestroyMIPServer(&srv);
+}
+
+/* a bounded FIFO handing work between the stages of the batch pipeline. Push waits while it is
+   full and Pop while it is empty; once every producer has called FinishMIPQueueProducer(), Pop
+   drains what is left and then returns NULL */
+typedef struct mip_queue
+{
+    void **item;
+    int capacity, head, count;
+    int producers;             /* still pushing */
+    pthread_mutex_t lock;
+    pthread_cond_t notempty, notfull;
+}iftMIPQueue;
+
+iftMIPQueue *CreateMIPQueue(int capacity, int producers)
+{
+    iftMIPQueue *q = (iftMIPQueue *) calloc(1, sizeof(iftMIPQueue));
+
+    q->item = (void **) calloc(capacity, sizeof(void *));
+    q->capacity = capacity;
+    q->producers = producers;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->notempty, NULL);
+    pthread_cond_init(&q->notfull, NULL);
+
+    return q;
+}
+
+void DestroyMIPQueue(iftMIPQueue **q)
+{
+    if (*q == NULL)
+        return;
+
+    pthread_mutex_destroy(&(*q)->lock);
+    pthread_cond_destroy(&(*q)->notempty);
+    pthread_cond_destroy(&(*q)->notfull);
+    free((*q)->item);
+    free(*q);
+    *q = NULL;
+}
+
+void PushMIPQueue(iftMIPQueue *q, void *item)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->count == q->capacity)
+        pthread_cond_wait(&q->notfull, &q->lock);
+    q->item[(q->head + q->count) % q->capacity] = item;
+    q->count++;
+    pthread_cond_signal(&q->notempty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+void *PopMIPQueue(iftMIPQueue *q)
+{
+    void *item = NULL;
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && q->producers > 0)
+        pthread_cond_wait(&q->notempty, &q->lock);
+    if (q->count > 0)
+    {
+        item = q->item[q->head];
+        q->head = (q->head + 1) % q->capacity;
+        q->count--;
+        pthread_cond_signal(&q->notfull);
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return item;
+}
+
+void FinishMIPQueueProducer(iftMIPQueue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    if (--q->producers == 0)
+        pthread_cond_broadcast(&q->notempty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/* caps the volumes a batch holds in memory between being read and rendered: at most maxvolumes
+   of them, and no new one is read while those in flight take maxbytes or more. A volume larger
+   than maxbytes still goes through on its own */
+typedef struct mip_budget
+{
+    int volumes, maxvolumes;
+    long bytes, maxbytes;
+    pthread_mutex_t lock;
+    pthread_cond_t freed;
+}iftMIPBudget;
+
+void AcquireMIPBudget(iftMIPBudget *b)
+{
+    pthread_mutex_lock(&b->lock);
+    while (b->volumes >= b->maxvolumes || (b->volumes > 0 && b->bytes >= b->maxbytes))
+        pthread_cond_wait(&b->freed, &b->lock);
+    b->volumes++;
+    pthread_mutex_unlock(&b->lock);
+}
+
+/* bytes are only known once the volume is read, so they are charged after AcquireMIPBudget() */
+void ChargeMIPBudget(iftMIPBudget *b, long bytes)
+{
+    pthread_mutex_lock(&b->lock);
+    b->bytes += bytes;
+    pthread_mutex_unlock(&b->lock);
+}
+
+void ReleaseMIPBudget(iftMIPBudget *b, long bytes)
+{
+    pthread_mutex_lock(&b->lock);
+    b->volumes--;
+    b->bytes -= bytes;
+    pthread_cond_broadcast(&b->freed);
+    pthread_mutex_unlock(&b->lock);
+}
+
+/* memory held by vol, built from img, once its source voxels are released */
+long MIPVolumeBytes(const iftImage *img, const iftMIPVolume *vol)
+{
+    long bytes = 0;
+    int l;
+
+    if (img->val != NULL)
+        bytes += (long) img->n * sizeof(int);
+    if (vol->vox != NULL && vol->vox->owned)
+        bytes += (long) vol->vox->size[0] * vol->vox->size[1] * vol->vox->size[2] * VoxelTypeSize(vol->vox->type);
+    if (vol->bricks != NULL)
+        bytes += (long) vol->bricks->nbx * vol->bricks->nby * vol->bricks->nbz * sizeof(int);
+    for (l = 1; vol->pyr != NULL && l < vol->pyr->nlevels; l++)
+        if (vol->pyr->level[l]->val != NULL)
+            bytes += (long) vol->pyr->level[l]->n * sizeof(int);
+
+    return bytes;
+}
+
+/* one file on its way through the batch pipeline */
+typedef struct mip_batch_item
+{
+    const char *path;
+    iftImage *img;
+    iftMIPVolume *vol;
+    long bytes;                /* charged to the budget until the volume is rendered */
+    iftImage *view;
+}iftMIPBatchItem;
+
+typedef struct mip_batch
+{
+    char **path;
+    int npaths;
+    const char *output;        /* folder of the PNGs */
+    float xtheta, ytheta;
+    int verbose;               /* reports each file as it is written or skipped */
+    iftMIPBudget budget;
+    iftMIPQueue *volumes, *views;
+    int next, done;            /* next path to read, paths finished or skipped */
+}iftMIPBatch;
+
+/* the paths of a batch: every file of dir ending in one of the comma-separated suffixes, in
+   suffix order, or the files listed by a .csv */
+char **LoadMIPBatchPaths(const char *input, const char *suffixes, int *npaths)
+{
+    char **path = NULL, *list = iftCopyString(suffixes), *suffix, *rest = NULL;
+    size_t i;
+
+    *npaths = 0;
+    if (iftEndsWith(input, ".csv"))
+    {
+        iftFileSet *fs = iftLoadFileSetFromCSV(input, false);
+
+        path = (char **) calloc(fs->n, sizeof(char *));
+        for (i = 0; i < fs->n; i++)
+            path[(*npaths)++] = iftCopyString(fs->files[i]->path);
+        iftDestroyFileSet(&fs);
+    }
+    else
+        for (suffix = strtok_r(list, ",", &rest); suffix != NULL; suffix = strtok_r(NULL, ",", &rest))
+        {
+            iftFileSet *fs = iftLoadFileSetFromDirBySuffix(input, suffix);
+
+            path = (char **) realloc(path, (*npaths + fs->n) * sizeof(char *));
+            for (i = 0; i < fs->n; i++)
+                path[(*npaths)++] = iftCopyString(fs->files[i]->path);
+            iftDestroyFileSet(&fs);
+        }
+    free(list);
+
+    return path;
+}
+
+/* the PNG written for path: its name, less the volume extension, in the output folder */
+void MIPBatchOutputPath(const iftMIPBatch *batch, const char *path, char *out, size_t size)
+{
+    const char *ext[] = {".nii.gz", ".zscn", ".scn", ".nii", ".raw"};
+    char *name = iftBasename(path);
+    int i, len = strlen(name);
+
+    for (i = 0; i < (int) (sizeof(ext) / sizeof(ext[0])); i++)
+        if (iftEndsWith(name, ext[i]))
+        {
+            name[len - strlen(ext[i])] = '\0';
+            break;
+        }
+    snprintf(out, size, "%s/%s.png", batch->output, name);
+    free(name);
+}
+
+void ReportMIPBatch(iftMIPBatch *batch, const char *path, const char *status)
+{
+    int done;
+
+    #pragma omp atomic capture
+    done = ++batch->done;
+
+    if (batch->verbose)
+    {
+        #pragma omp critical (mip_progress)
+        {
+            printf("[%d/%d] %s %s\n", done, batch->npaths, path, status);
+            fflush(stdout);
+        }
+    }
+}
+
+/* reader stage: takes the next path, waits for room in the budget, then reads the volume and
+   builds what the ray caster needs from it */
+void ReadBatchVolumes(iftMIPBatch *batch, const iftMIPOptions *opt)
+{
+    char reason[1200], status[1300];
+    int i;
+
+    for (;;)
+    {
+        iftMIPBatchItem *item;
+        double t0;
+
+        #pragma omp atomic capture
+        i = batch->next++;
+        if (i >= batch->npaths)
+            break;
+
+        /* a missing, malformed or truncated file must not end a nightly run */
+        if (!CheckVolumeFile(batch->path[i], reason, sizeof(reason)))
+        {
+            snprintf(status, sizeof(status), "skipped: %s", reason);
+            ReportMIPBatch(batch, batch->path[i], status);
+            continue;
+        }
+
+        AcquireMIPBudget(&batch->budget);
+        item = (iftMIPBatchItem *) calloc(1, sizeof(iftMIPBatchItem));
+        item->path = batch->path[i];
+
+        t0 = omp_get_wtime();
+        item->img = iftReadImageByExt(item->path);
+        if (opt->stats != NULL)
+            AddMIPTime(&opt->stats->load_ms, t0);
+
+        /* nor may values that CreateMIPVoxels() cannot store in the -voxels type */
+        if (opt->mode == MIP_RAYCAST && opt->voxels != MIP_VOXEL_INT32 && opt->voxels != MIP_VOXEL_AUTO)
+        {
+            int minval = iftMinimumValue(item->img), maxval = iftMaximumValue(item->img);
+
+            if (!VoxelTypeHolds(opt->voxels, minval, maxval))
+            {
+                snprintf(status, sizeof(status), "skipped: voxel values in [%d, %d] do not fit the -voxels type",
+                         minval, maxval);
+                ReportMIPBatch(batch, item->path, status);
+                iftDestroyImage(&item->img);
+                free(item);
+                ReleaseMIPBudget(&batch->budget, 0);
+                continue;
+            }
+        }
+        item->vol = CreateMIPVolume(item->img, opt);
+        ReleaseMIPVolumeSource(item->vol);
+
+        item->bytes = MIPVolumeBytes(item->img, item->vol);
+        ChargeMIPBudget(&batch->budget, item->bytes);
+        PushMIPQueue(batch->volumes, item);
+    }
+    FinishMIPQueueProducer(batch->volumes);
+}
+
+/* render stage: one view per volume, which is freed as soon as it is cast */
+void RenderBatchViews(iftMIPBatch *batch, const iftMIPOptions *opt)
+{
+    iftMIPBatchItem *item;
+
+    while ((item = (iftMIPBatchItem *) PopMIPQueue(batch->volumes)) != NULL)
+    {
+        item->view = RenderMIPView(item->vol, batch->xtheta, batch->ytheta, opt);
+        DestroyMIPVolume(&item->vol);
+        iftDestroyImage(&item->img);
+        ReleaseMIPBudget(&batch->budget, item->bytes);
+        PushMIPQueue(batch->views, item);
+    }
+    FinishMIPQueueProducer(batch->views);
+}
+
+/* encoder stage: stretches each view to 8 bits, as single renders do, and writes it as a PNG */
+void EncodeBatchViews(iftMIPBatch *batch, const iftMIPOptions *opt)
+{
+    iftMIPBatchItem *item;
+    char path[1024];
+
+    while ((item = (iftMIPBatchItem *) PopMIPQueue(batch->views)) != NULL)
+    {
+        MIPBatchOutputPath(batch, item->path, path, sizeof(path));
+        WriteNormalizedView(item->view, path, opt->stats);
+        ReportMIPBatch(batch, item->path, path);
+        iftDestroyImage(&item->view);
+        free(item);
+    }
+}
+
+/* renders the view (xtheta, ytheta) of every file in paths to a PNG in output. Reader, render
+   and encoder threads run at once, handing volumes and views over bounded queues, so that
+   reading and decoding the next studies overlaps with casting and writing the current ones.
+   At most maxvolumes volumes, taking about maxbytes, wait between reading and rendering.
+   Each renderer casts its view on a single thread: the studies are the unit of parallelism */
+void RenderMIPBatch(char **paths, int npaths, const char *output, float xtheta, float ytheta, int readers,
+                    int renderers, int encoders, int maxvolumes, long maxbytes, const iftMIPOptions *opt)
+{
+    iftMIPBatch batch;
+    iftMIPOptions ropt = *opt;
+    int nthreads = readers + renderers + encoders, started = 0;
+
+    if (readers < 1 || renderers < 1 || encoders < 1 || maxvolumes < 1)
+        iftError("The batch needs at least one reader, renderer, encoder and volume in flight", "RenderMIPBatch");
+    /* every stage blocks on its queues, so each needs a thread of its own */
+    omp_set_dynamic(0);
+    if (nthreads > omp_get_thread_limit())
+        iftError("Could not start %d batch threads, the limit is %d", "RenderMIPBatch", nthreads,
+                 omp_get_thread_limit());
+    if (!iftDirExists(output))
+        iftMakeDir(output);
+
+    memset(&batch, 0, sizeof(batch));
+    batch.path = paths;
+    batch.npaths = npaths;
+    batch.output = output;
+    batch.xtheta = xtheta;
+    batch.ytheta = ytheta;
+    batch.verbose = opt->verbose;
+    batch.budget.maxvolumes = maxvolumes;
+    batch.budget.maxbytes = maxbytes;
+    pthread_mutex_init(&batch.budget.lock, NULL);
+    pthread_cond_init(&batch.budget.freed, NULL);
+    batch.volumes = CreateMIPQueue(maxvolumes, readers);
+    batch.views = CreateMIPQueue(2 * encoders, renderers);
+
+    ropt.nthreads = 1;
+    ropt.verbose = 0;
+    ropt.cache = 0;
+
+    #pragma omp parallel num_threads(nthreads)
+    {
+        int t = omp_get_thread_num();
+
+        #pragma omp master
+        started = omp_get_num_threads();
+
+        /* a short team runs no stage at all, rather than leave one blocked on the others */
+        if (omp_get_num_threads() == nthreads)
+        {
+            if (t < readers)
+                ReadBatchVolumes(&batch, &ropt);
+            else if (t < readers + renderers)
+                RenderBatchViews(&batch, &ropt);
+            else
+                EncodeBatchViews(&batch, opt);
+        }
+    }
+
+    DestroyMIPQueue(&batch.volumes);
+    DestroyMIPQueue(&batch.views);
+    pthread_mutex_destroy(&batch.budget.lock);
+    pthread_cond_destroy(&batch.budget.freed);
+
+    if (started < nthreads)
+        iftError("Could not start %d batch threads, only %d", "RenderMIPBatch", nthreads, started);
+}
+
+/* builds that embed the renderer, such as mip_bench, define MIP_NO_MAIN */
+#ifndef MIP_NO_MAIN
+int main(int argc, char *argv[])
+{
+    if (argc >= 3 && strcmp(argv[1], "-serve") == 0)
+    {
+        iftMIPOptions opt = DefaultMIPOptions();
+        int i, capacity = 4;
+
+        for (i = 3; i + 1 < argc; i += 2)
+        {
+            if (strcmp(argv[i], "-threads") == 0)
+                opt.nthreads = atoi(argv[i + 1]);
+            else if (strcmp(argv[i], "-skip") == 0)
+                opt.skip = atoi(argv[i + 1]);
+            else if (strcmp(argv[i], "-mode") == 0)
+                opt.mode = (strcmp(argv[i + 1], "shearwarp") == 0) ? MIP_SHEARWARP : MIP_RAYCAST;
+            else if (strcmp(argv[i], "-layout") == 0)
+                opt.layout = (strcmp(argv[i + 1], "bricked") == 0) ? MIP_LAYOUT_BRICKED : MIP_LAYOUT_LINEAR;
+            else if (strcmp(argv[i], "-voxels") == 0)
+                opt.voxels = ParseVoxelType(argv[i + 1]);
+            else if (strcmp(argv[i], "-adaptive") == 0)
+                opt.adaptive = atof(argv[i + 1]);
+            else if (strcmp(argv[i], "-traversal") == 0)
+                opt.traversal = ParseTraversal(argv[i + 1]);
+            else if (strcmp(argv[i], "-lmip") == 0)
+            {
+                opt.lmip = 1;
+                opt.threshold = atoi(argv[i + 1]);
+            }
+            else if (strcmp(argv[i], "-volumes") == 0)
+                capacity = atoi(argv[i + 1]);
+            else
+                iftError("Unknown option %s", "main", argv[i]);
+        }
+        /* checked up front, as it would otherwise end the server on the first ray-cast request */
+        if (opt.lmip && opt.traversal != MIP_TRAVERSAL_DDA)
+            iftError("The local MIP walks rays with the DDA traversal", "main");
+        ServeMIP(argv[2], capacity, &opt);
+        return 0;
+    }
+
+    if (argc >= 4 && strcmp(argv[1], "-batch") == 0)
+    {
+        iftMIPOptions opt = DefaultMIPOptions();
+        iftMIPStats stats;
+        const char *suffixes = ".scn,.zscn,.nii,.nii.gz";
+        char *statsFile = NULL, **paths;
+        float tilt = 0, spin = 0;
+        long memory = 2048;
+        int i, npaths, readers = 2, renderers = 0, encoders = 1, inflight = 0;
+
+        for (i = 4; i + 1 < argc; i += 2)
+        {
+            if (strcmp(argv[i], "-suffix") == 0)
+                suffixes = argv[i + 1];
+            else if (strcmp(argv[i], "-tilt") == 0)
+                tilt = atof(argv[i + 1]);
+            else if (strcmp(argv[i], "-spin") == 0)
+                spin = atof(argv[i + 1]);
+            else if (strcmp(argv[i], "-readers") == 0)
+                readers = atoi(argv[i + 1]);
+            else if (strcmp(argv[i], "-renderers") == 0)
+                renderers = atoi(argv[i + 1]);
+            else if (strcmp(argv[i], "-encoders") == 0)
+                encoders = atoi(argv[i + 1]);
+            else if (strcmp(argv[i], "-inflight") == 0)
+                inflight = atoi(argv[i + 1]);
+            else if (strcmp(argv[i], "-memory") == 0)
+                memory = atol(argv[i + 1]);
+            else if (strcmp(argv[i], "-threads") == 0)
+                opt.nthreads = atoi(argv[i + 1]);
+            else if (strcmp(argv[i], "-skip") == 0)
+                opt.skip = atoi(argv[i + 1]);
+            else if (strcmp(argv[i], "-level") == 0)
+                opt.level = atoi(argv[i + 1]);
+            else if (strcmp(argv[i], "-mode") == 0)
+                opt.mode = (strcmp(argv[i + 1], "shearwarp") == 0) ? MIP_SHEARWARP : MIP_RAYCAST;
+            else if (strcmp(argv[i], "-layout") == 0)
+                opt.layout = (strcmp(argv[i + 1], "bricked") == 0) ? MIP_LAYOUT_BRICKED : MIP_LAYOUT_LINEAR;
+            else if (strcmp(argv[i], "-voxels") == 0)
+                opt.voxels = ParseVoxelType(argv[i + 1]);
+            else if (strcmp(argv[i], "-adaptive") == 0)
+                opt.adaptive = atof(argv[i + 1]);
+            else if (strcmp(argv[i], "-traversal") == 0)
+                opt.traversal = ParseTraversal(argv[i + 1]);
+            else if (strcmp(argv[i], "-lmip") == 0)
+            {
+                opt.lmip = 1;
+                opt.threshold = atoi(argv[i + 1]);
+            }
+            else if (strcmp(argv[i], "-stats") == 0)
+                statsFile = argv[i + 1];
+            else
+                iftError("Unknown option %s", "main", argv[i]);
+        }
+
+        /* renderers take the cores left by the readers and encoders, which mostly wait on I/O */
+        if (renderers <= 0)
+            renderers = iftMax(1, ((opt.nthreads > 0) ? opt.nthreads : omp_get_max_threads()) - readers - encoders);
+        if (inflight <= 0)
+            inflight = readers + renderers;
+
+        memset(&stats, 0, sizeof(stats));
+        if (statsFile != NULL)
+            opt.stats = &stats;
+
+        paths = LoadMIPBatchPaths(argv[2], suffixes, &npaths);
+        RenderMIPBatch(paths, npaths, argv[3], tilt, spin, readers, renderers, encoders, inflight,
+                       memory * 1024 * 1024, &opt);
+
+        if (statsFile != NULL)
+            WriteMIPStats(&stats, statsFile);
+        for (i = 0; i < npaths; i++)
+            free(paths[i]);
+        free(paths);
+        return 0;
+    }
+
+    if (argc < 5)
+        iftError("Run: ./MIP <filename> <output> <tilt> <spin> [-threads N] [-mode raycast|shearwarp] [-skip 0|1] "
+                 "[-layout linear|bricked] [-voxels int32|uint16|int16|uint8|auto] "
+                 "[-mmap lazy|populate|willneed|random] [-stream D] [-level L] [-frames N -dtilt D -dspin D | -angles file] "
+                 "[-cache N] [-slab S [-axis x|y|z]] [-stats file.json] [-progressive 0|1] [-adaptive T] "
+                 "[-traversal dda|exact] [-lmip T] [-project max,min,mean,depth] "
+                 "[-eye x,y,z [-at x,y,z] [-up x,y,z] [-fov F] [-near N] [-far F] [-size WxH]]\n"
+                 "   or: ./MIP -serve <socket|-> [-volumes K] [-threads N] [-mode raycast|shearwarp] [-skip 0|1] "
+                 "[-layout linear|bricked] [-voxels int32|uint16|int16|uint8|auto] [-adaptive T] "
+                 "[-traversal dda|exact] [-lmip T]\n"
+                 "   or: ./MIP -batch <folder|files.csv> <output folder> [-suffix .scn,.zscn,.nii,.nii.gz] [-tilt T] "
+                 "[-spin S] [-readers R] [-renderers N] [-encoders E] [-inflight K] [-memory MB] [-threads N] "
+                 "[-mode raycast|shearwarp] [-skip 0|1] [-level L] [-layout linear|bricked] "
+                 "[-voxels int32|uint16|int16|uint8|auto] [-adaptive T] [-traversal dda|exact] [-lmip T] "
+                 "[-stats file.json]", "main");
+
+    char buffer[512];
+
+    float tx, ty, dtilt = 0, dspin = 0;
+    float *tilt = NULL, *spin = NULL;
+    int i, nframes = 1, slab = 0, mapped = 0, stream = 0, progressive = 0, outputs = 0;
+    int *camera = (int *) malloc(argc * sizeof(int)), ncamera = 0;
+    iftMIPCamera cam;
+    iftMIPMapHint hint = MIP_MAP_LAZY;
+    iftMIPStats stats;
+    char axis = IFT_AXIS_Z;
+    char *angles = NULL, *statsFile = NULL;
+    iftMIPOptions opt = DefaultMIPOptions();
+    tx = atof(argv[3]);
+    ty = atof(argv[4]);
+    for (i = 5; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "-threads") == 0)
+            opt.nthreads = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-level") == 0)
+            opt.level = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-skip") == 0)
+            opt.skip = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-mode") == 0)
+            opt.mode = (strcmp(argv[i + 1], "shearwarp") == 0) ? MIP_SHEARWARP : MIP_RAYCAST;
+        else if (strcmp(argv[i], "-layout") == 0)
+            opt.layout = (strcmp(argv[i + 1], "bricked") == 0) ? MIP_LAYOUT_BRICKED : MIP_LAYOUT_LINEAR;
+        else if (strcmp(argv[i], "-voxels") == 0)
+            opt.voxels = ParseVoxelType(argv[i + 1]);
+        else if (strcmp(argv[i], "-frames") == 0)
+            nframes = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-dtilt") == 0)
+            dtilt = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "-dspin") == 0)
+            dspin = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "-slab") == 0)
+            slab = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-axis") == 0)
+            axis = (argv[i + 1][0] == 'x') ? IFT_AXIS_X : (argv[i + 1][0] == 'y') ? IFT_AXIS_Y : IFT_AXIS_Z;
+        else if (strcmp(argv[i], "-cache") == 0)
+            opt.cache = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-angles") == 0)
+            angles = argv[i + 1];
+        else if (strcmp(argv[i], "-stream") == 0)
+            stream = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-stats") == 0)
+            statsFile = argv[i + 1];
+        else if (strcmp(argv[i], "-progressive") == 0)
+            progressive = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-adaptive") == 0)
+            opt.adaptive = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "-traversal") == 0)
+            opt.traversal = ParseTraversal(argv[i + 1]);
+        else if (strcmp(argv[i], "-project") == 0)
+            outputs = ParseProjections(argv[i + 1]);
+        else if (strcmp(argv[i], "-lmip") == 0)
+        {
+            opt.lmip = 1;
+            opt.threshold = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "-eye") == 0 || strcmp(argv[i], "-at") == 0 || strcmp(argv[i], "-up") == 0 ||
+                 strcmp(argv[i], "-fov") == 0 || strcmp(argv[i], "-near") == 0 || strcmp(argv[i], "-far") == 0 ||
+                 strcmp(argv[i], "-size") == 0)
+            camera[ncamera++] = i;     /* applied once the volume size is known */
+        else if (strcmp(argv[i], "-mmap") == 0)
+        {
+            mapped = 1;
+            hint = ParseMapHint(argv[i + 1]);
+        }
+        else
+            iftError("Unknown option %s", "main", argv[i]);
+    }
+    char *imgFileName = iftCopyString(argv[1]);
+    iftImage *img = NULL, *output = NULL;
+    iftMIPVolume *vol;
+
+    memset(&stats, 0, sizeof(stats));
+    if (statsFile != NULL)
+        opt.stats = &stats;
+
+    if (slab > 0)
+    {
+        img = iftReadImageByExt(imgFileName);
+        iftImage *slabs = SlidingSlabMIP(img, axis, slab, opt.nthreads);
+
+        if (snprintf(buffer, sizeof(buffer), "data/%s", argv[2]) >= (int) sizeof(buffer))
+            iftError("Output name %s is too long", "main", argv[2]);
+        WriteSlabMIP(slabs, axis, buffer);
+        iftDestroyImage(&slabs);
+        iftDestroyImage(&img);
+        return 0;
+    }
+
+    if (stream > 0)
+    {
+        if (angles != NULL || nframes > 1 || opt.mode != MIP_RAYCAST || opt.level > 0 ||
+            opt.traversal != MIP_TRAVERSAL_DDA || opt.lmip || ncamera > 0)
+            iftError("-stream renders a single orthographic ray-cast view at level 0 with the DDA traversal and "
+                     "no local MIP", "main");
+        output = StreamingMIP(imgFileName, tx, ty, stream, &opt);
+        WriteMIPView(output, tx, ty, argv[2], opt.stats);
+    }
+    else
+    {
+        if (mapped)
+            vol = CreateMappedMIPVolume(imgFileName, hint, &opt);
+        else
+        {
+            double t0 = omp_get_wtime();
+
+            img = iftReadImageByExt(imgFileName);
+            if (opt.stats != NULL)
+                AddMIPTime(&opt.stats->load_ms, t0);
+            vol = CreateMIPVolume(img, &opt);
+            ReleaseMIPVolumeSource(vol);
+        }
+
+        if (ncamera > 0)
+        {
+            cam = DefaultMIPCamera((img != NULL) ? img : vol->img);
+            for (i = 0; i < ncamera; i++)
+            {
+                const char *name = argv[camera[i]], *value = argv[camera[i] + 1];
+
+                if (strcmp(name, "-eye") == 0)
+                    cam.eye = ParseVector(value);
+                else if (strcmp(name, "-at") == 0)
+                    cam.at = ParseVector(value);
+                else if (strcmp(name, "-up") == 0)
+                    cam.up = ParseVector(value);
+                else if (strcmp(name, "-fov") == 0)
+                    cam.fov = atof(value);
+                else if (strcmp(name, "-near") == 0)
+                    cam.near = atof(value);
+                else if (strcmp(name, "-far") == 0)
+                    cam.far = atof(value);
+                else if (sscanf(value, "%dx%d", &cam.xsize, &cam.ysize) != 2)
+                    iftError("Invalid image size %s, expected WxH", "main", value);
+            }
+            opt.camera = &cam;
+        }
+
+        if (angles != NULL || nframes > 1)
+        {
+            if (angles != NULL)
+                nframes = ReadSweepAngles(angles, &tilt, &spin);
+            else
+            {
+                tilt = (float *) malloc(nframes * sizeof(float));
+                spin = (float *) malloc(nframes * sizeof(float));
+                for (i = 0; i < nframes; i++)
+                {
+                    tilt[i] = tx + i * dtilt;
+                    spin[i] = ty + i * dspin;
+                }
+            }
+
+            if (snprintf(buffer, sizeof(buffer), "data/%s", argv[2]) >= (int) sizeof(buffer))
+                iftError("Output name %s is too long", "main", argv[2]);
+            RenderMIPSweep(vol, tilt, spin, nframes, &opt, buffer);
+            free(tilt);
+            free(spin);
+        }
+        else if (outputs != 0)
+        {
+            iftMIPProjections *proj = ProjectMIPView(vol, tx, ty, outputs, &opt);
+
+            WriteMIPProjections(proj, tx, ty, argv[2], opt.stats);
+            DestroyMIPProjections(&proj);
+        }
+        else if (progressive)
+        {
+            iftMIPPassWriter writer = {argv[2], tx, ty, vol->volmax, opt.stats};
+
+            /* passes are written from inside the render, so their paths are checked here; there
+               are fewer of them than MIP_PROGRESSIVE_STEP */
+            if (snprintf(buffer, sizeof(buffer), "data/%.1f%.1fpass%d%s", tx, ty, MIP_PROGRESSIVE_STEP,
+                         argv[2]) >= (int) sizeof(buffer))
+                iftError("Output name %s is too long", "main", argv[2]);
+            output = RenderMIPViewProgressive(vol, tx, ty, &opt, WriteProgressivePass, &writer);
+            WriteMIPView(output, tx, ty, argv[2], opt.stats);
+        }
+        else
+        {
+            output = RenderMIPView(vol, tx, ty, &opt);
+            WriteMIPView(output, tx, ty, argv[2], opt.stats);
+        }
+
+        DestroyMIPVolume(&vol);
+        iftDestroyImage(&img);
+    }
+
+    if (statsFile != NULL)
+        WriteMIPStats(&stats, statsFile);
+    free(camera);
 
-    iftWriteImageByExt(normalizedImage, buffer);
-    iftDestroyImage(&img);
-    iftDestroyImage(&output);
     return 0;
 }
+#endif
@@ -0,0 +1,285 @@
+#include <sys/resource.h>
+
+#define MIP_NO_MAIN
+#include "MIP.c"
+
+/* views rendered for every volume, the same in every run so that numbers can be compared */
+static const float BenchTilt[] = {0, 0, 90, 30, 45, 60, 15, 75};
+static const float BenchSpin[] = {0, 90, 0, 45, 30, 120, 200, 300};
+#define MIP_BENCH_VIEWS ((int) (sizeof(BenchTilt) / sizeof(BenchTilt[0])))
+
+typedef struct mip_bench_result
+{
+    char name[256];
+    int xsize, ysize, zsize;
+    float setup_ms;
+    float ms_per_frame;
+    double rays;       /* rays that hit the volume, per frame */
+    double samples;    /* sample positions along those rays, per frame */
+    long peak_rss_kb;
+}iftMIPBenchResult;
+
+/* peak resident set size of the process so far */
+long PeakRSSKB(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+    return ru.ru_maxrss / 1024;
+#else
+    return ru.ru_maxrss;
+#endif
+}
+
+/* "cuboid:SIZE[:DENSITY]", "gaussian:SIZE[:STDEV]" and "noise:SIZE" make synthetic volumes,
+   SIZE being N or XxYxZ; anything else is read as a file */
+iftImage *BenchVolume(const char *spec)
+{
+    int x, y, z;
+    float param = -1;
+    const char *colon = strchr(spec, ':');
+
+    if (strncmp(spec, "cuboid:", 7) != 0 && strncmp(spec, "gaussian:", 9) != 0 && strncmp(spec, "noise:", 6) != 0)
+        return iftReadImageByExt(spec);
+
+    if (sscanf(colon + 1, "%dx%dx%d", &x, &y, &z) != 3)
+    {
+        if (sscanf(colon + 1, "%d", &x) != 1)
+            iftError("Invalid volume size in %s", "BenchVolume", spec);
+        y = z = x;
+    }
+    if ((colon = strchr(colon + 1, ':')) != NULL)
+        param = atof(colon + 1);
+
+    if (strncmp(spec, "cuboid:", 7) == 0)
+        return iftCreateCuboid(x, y, z, (param > 0) ? param : 0.1, 4095);
+    if (strncmp(spec, "gaussian:", 9) == 0)
+    {
+        iftVoxel mean = {.x = x / 2, .y = y / 2, .z = z / 2};
+
+        return iftCreateGaussian(x, y, z, mean, (param > 0) ? param : iftMin(x, iftMin(y, z)) / 6.0, 4095);
+    }
+
+    return iftCreateImageWithGaussianHistogram(x, y, z, 2048, 512, 4095);
+}
+
+/* rays of a view that hit the volume and the sample positions DDA() walks along them */
+void CountViewWork(iftImage *img, float xtheta, float ytheta, double *rays, double *samples)
+{
+    iftRaySetup rs = ViewRaySetup(img, xtheta, ytheta);
+    int N = VolumeDiagonal(img), v;
+    double r = 0, s = 0;
+
+    #pragma omp parallel for reduction(+:r,s)
+    for (v = 0; v < N; v++)
+    {
+        int u;
+        iftVoxel p1, pn;
+        iftVector d;
+
+        for (u = 0; u < N; u++)
+            if (ComputeIntersection(RayOrigin(&rs, u, v), img, rs.dir, &p1, &pn))
+            {
+                r += 1;
+                s += DDASetup(p1, pn, &d);
+            }
+    }
+
+    *rays += r;
+    *samples += s;
+}
+
+/* renders each view, the view from the opposite side and the view again through one view cache,
+   as sweeps do, and returns the pixels that differ from rendering them afresh */
+long CheckViewCache(const iftMIPVolume *vol, const iftMIPOptions *opt)
+{
+    iftMIPViewCache *cache = CreateMIPViewCache(2 * MIP_BENCH_VIEWS);
+    long ndiff = 0;
+    int i, k, p;
+
+    for (i = 0; i < MIP_BENCH_VIEWS; i++)
+        for (k = 0; k < 3; k++)
+        {
+            float spin = BenchSpin[i] + ((k == 1) ? 180 : 0);
+            iftImage *cached = RenderMIPViewCached(vol, cache, BenchTilt[i], spin, opt);
+            iftImage *fresh = RenderMIPView(vol, BenchTilt[i], spin, opt);
+
+            for (p = 0; p < fresh->n; p++)
+                ndiff += (cached->val[p] != fresh->val[p]);
+            iftDestroyImage(&cached);
+            iftDestroyImage(&fresh);
+        }
+
+    DestroyMIPViewCache(&cache);
+
+    return ndiff;
+}
+
+iftMIPBenchResult BenchOneVolume(const char *spec, int repeat, int check, const iftMIPOptions *opt)
+{
+    iftMIPBenchResult res;
+    iftMIPVolume *vol;
+    iftImage *img, *output;
+    timer *tic;
+    float ms = 0;
+    int i, r;
+
+    memset(&res, 0, sizeof(res));
+    snprintf(res.name, sizeof(res.name), "%s", spec);
+
+    img = BenchVolume(spec);
+    res.xsize = img->xsize; res.ysize = img->ysize; res.zsize = img->zsize;
+
+    tic = iftTic();
+    vol = CreateMIPVolume(img, opt);
+    res.setup_ms = iftCompTime(tic, iftToc());
+
+    if (check)
+    {
+        long ndiff = CheckViewCache(vol, opt);
+
+        if (ndiff > 0)
+            iftError("%ld pixels of %s differ when rendered through the view cache", "BenchOneVolume", ndiff, spec);
+        fprintf(stderr, "%s: views through the view cache are identical\n", spec);
+    }
+
+    for (i = 0; i < MIP_BENCH_VIEWS; i++)
+        CountViewWork(vol->img, BenchTilt[i], BenchSpin[i], &res.rays, &res.samples);
+    res.rays /= MIP_BENCH_VIEWS;
+    res.samples /= MIP_BENCH_VIEWS;
+
+    /* one untimed pass warms the caches and the thread pool */
+    output = RenderMIPView(vol, BenchTilt[0], BenchSpin[0], opt);
+    iftDestroyImage(&output);
+
+    for (r = 0; r < repeat; r++)
+        for (i = 0; i < MIP_BENCH_VIEWS; i++)
+        {
+            tic = iftTic();
+            output = RenderMIPView(vol, BenchTilt[i], BenchSpin[i], opt);
+            ms += iftCompTime(tic, iftToc());
+            iftDestroyImage(&output);
+        }
+    res.ms_per_frame = ms / (repeat * MIP_BENCH_VIEWS);
+    res.peak_rss_kb = PeakRSSKB();
+
+    DestroyMIPVolume(&vol);
+    iftDestroyImage(&img);
+
+    return res;
+}
+
+void WriteBenchResults(FILE *fp, const iftMIPBenchResult *res, int n, int csv, const iftMIPOptions *opt)
+{
+    const char *mode = (opt->mode == MIP_SHEARWARP) ? "shearwarp" : "raycast";
+    const char *layout = (opt->layout == MIP_LAYOUT_BRICKED) ? "bricked" : "linear";
+    const char *voxels[] = {"int32", "uint16", "int16", "uint8", "auto"};
+    int nthreads = (opt->nthreads > 0) ? opt->nthreads : omp_get_max_threads();
+    int i;
+
+    if (csv)
+        fprintf(fp, "volume,xsize,ysize,zsize,mode,kernel,layout,voxels,skip,level,threads,"
+                    "setup_ms,ms_per_frame,rays_per_s,samples_per_s,peak_rss_kb\n");
+    else
+        fprintf(fp, "{\n  \"mode\": \"%s\",\n  \"kernel\": \"%s\",\n  \"layout\": \"%s\",\n  \"voxels\": \"%s\",\n"
+                    "  \"skip\": %d,\n  \"level\": %d,\n  \"threads\": %d,\n  \"views\": %d,\n  \"results\": [\n",
+                mode, RayKernel(opt).name, layout, voxels[opt->voxels], opt->skip, opt->level, nthreads,
+                MIP_BENCH_VIEWS);
+
+    for (i = 0; i < n; i++)
+    {
+        double s = res[i].ms_per_frame / 1000.0;
+
+        if (csv)
+            fprintf(fp, "%s,%d,%d,%d,%s,%s,%s,%s,%d,%d,%d,%.3f,%.3f,%.0f,%.0f,%ld\n", res[i].name,
+                    res[i].xsize, res[i].ysize, res[i].zsize, mode, RayKernel(opt).name, layout,
+                    voxels[opt->voxels], opt->skip, opt->level, nthreads, res[i].setup_ms, res[i].ms_per_frame,
+                    res[i].rays / s, res[i].samples / s, res[i].peak_rss_kb);
+        else
+            fprintf(fp, "    {\"volume\": \"%s\", \"size\": [%d, %d, %d], \"setup_ms\": %.3f, \"ms_per_frame\": %.3f, "
+                        "\"rays_per_s\": %.0f, \"samples_per_s\": %.0f, \"peak_rss_kb\": %ld}%s\n", res[i].name,
+                    res[i].xsize, res[i].ysize, res[i].zsize, res[i].setup_ms, res[i].ms_per_frame,
+                    res[i].rays / s, res[i].samples / s, res[i].peak_rss_kb, (i + 1 < n) ? "," : "");
+    }
+
+    if (!csv)
+        fprintf(fp, "  ]\n}\n");
+}
+
+int main(int argc, char *argv[])
+{
+    iftMIPOptions opt = DefaultMIPOptions();
+    iftMIPBenchResult *res;
+    const char *output = NULL;
+    char **specs;
+    int i, nspecs = 0, repeat = 3, csv = 0, check = 0;
+    FILE *fp = stdout;
+
+    if (argc < 2)
+        iftError("Run: ./mip_bench <volume>... [-repeat R] [-format json|csv] [-output file] [-threads N] "
+                 "[-mode raycast|shearwarp] [-skip 0|1] [-level L] [-layout linear|bricked] "
+                 "[-voxels int32|uint16|int16|uint8|auto] [-traversal dda|exact] [-lmip T] [-check 0|1]\n"
+                 "volume: a file, cuboid:SIZE[:DENSITY], gaussian:SIZE[:STDEV] or noise:SIZE, "
+                 "with SIZE as N or XxYxZ", "main");
+
+    opt.verbose = 0;
+    specs = (char **) calloc(argc, sizeof(char *));
+
+    for (i = 1; i < argc; i++)
+    {
+        if (argv[i][0] != '-')
+        {
+            specs[nspecs++] = argv[i];
+            continue;
+        }
+        if (i + 1 >= argc)
+            iftError("Missing value for %s", "main", argv[i]);
+
+        if (strcmp(argv[i], "-repeat") == 0)
+            repeat = iftMax(1, atoi(argv[i + 1]));
+        else if (strcmp(argv[i], "-format") == 0)
+            csv = (strcmp(argv[i + 1], "csv") == 0);
+        else if (strcmp(argv[i], "-check") == 0)
+            check = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-output") == 0)
+            output = argv[i + 1];
+        else if (strcmp(argv[i], "-threads") == 0)
+            opt.nthreads = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-mode") == 0)
+            opt.mode = (strcmp(argv[i + 1], "shearwarp") == 0) ? MIP_SHEARWARP : MIP_RAYCAST;
+        else if (strcmp(argv[i], "-skip") == 0)
+            opt.skip = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-level") == 0)
+            opt.level = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-layout") == 0)
+            opt.layout = (strcmp(argv[i + 1], "bricked") == 0) ? MIP_LAYOUT_BRICKED : MIP_LAYOUT_LINEAR;
+        else if (strcmp(argv[i], "-voxels") == 0)
+            opt.voxels = ParseVoxelType(argv[i + 1]);
+        else if (strcmp(argv[i], "-traversal") == 0)
+            opt.traversal = ParseTraversal(argv[i + 1]);
+        else if (strcmp(argv[i], "-lmip") == 0)
+        {
+            opt.lmip = 1;
+            opt.threshold = atoi(argv[i + 1]);
+        }
+        else
+            iftError("Unknown option %s", "main", argv[i]);
+        i++;
+    }
+
+    res = (iftMIPBenchResult *) calloc(nspecs, sizeof(iftMIPBenchResult));
+    for (i = 0; i < nspecs; i++)
+        res[i] = BenchOneVolume(specs[i], repeat, check, &opt);
+
+    if (output != NULL && (fp = fopen(output, "w")) == NULL)
+        iftError("Cannot open %s", "main", output);
+    WriteBenchResults(fp, res, nspecs, csv, &opt);
+    if (fp != stdout)
+        fclose(fp);
+
+    free(res);
+    free(specs);
+
+    return 0;
+}